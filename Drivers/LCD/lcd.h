@@ -16,6 +16,9 @@
  * is even greater if the AVR runs at a slower clock speed than the usual
  * 20MHz, e.g., when the user forgets to set the fuses. 
  * 
+ * The number writers use format.h and format.c from Drivers/Format, so copy
+ * those into your project along with lcd.h and lcd.c. 
+ * 
  * This driver disables interrupts while sending a command to the LCD but
  * otherwise does nothing to ensure synchronisation. Make sure to use the
  * appropriate mechanisms if you use it in an environment where interruptions
@@ -29,6 +32,10 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 //=============================================================================
 // Configuration
 
@@ -43,6 +50,63 @@
  */
 //#define LCD_BUSY_TIMEOUT 2000
 
+/**
+ * \brief Measure the LCD's execution times during initialisation
+ * 
+ * Without LCD_BUSY_TIMEOUT, the driver uses the worst-case execution times
+ * from the datasheet as delays. Most LCD controllers are a lot faster than
+ * that. If LCD_CALIBRATE is defined, lcd_init() reads the busy flag to
+ * measure how long the attached LCD actually takes and from then on uses the
+ * measured times plus LCD_CALIBRATE_MARGIN percent as delays. The results
+ * are available in lcd_timing. 
+ * This requires the R/W line to be connected. It cannot be combined with
+ * LCD_BUSY_TIMEOUT or LCD_ASYNC. 
+ */
+//#define LCD_CALIBRATE
+#define LCD_CALIBRATE_MARGIN 25
+
+/**
+ * \brief Skip the homing sequence if the LCD is still initialised
+ * 
+ * After a watchdog or brown-out reset, the LCD usually still has power and
+ * is in the mode the driver put it in. If LCD_WARM_START is defined,
+ * lcd_init() reads the busy flag and the address counter to check that and
+ * then only sets the display up again, without the 20ms or so of the homing
+ * sequence. "Clear display" is finished as soon as the LCD says so. 
+ * This requires the R/W line to be connected. 
+ */
+//#define LCD_WARM_START
+
+/**
+ * \brief Extra time in nanoseconds added to each bus timing parameter
+ * 
+ * The driver strobes EN as fast as the datasheet of the HD44780 at 5V allows
+ * (computed from F_CPU). Slower controllers, long cables or operation at 3V
+ * (about 300 for the HD44780) need some extra time, which can be given here. 
+ */
+//#define LCD_BUS_MARGIN_NS 100
+
+/**
+ * \brief Keep interrupts disabled for as short as possible
+ * 
+ * By default, the driver disables interrupts for the entire transfer of a
+ * byte to the LCD. With LCD_BUSY_TIMEOUT, this includes polling the busy flag
+ * and can take milliseconds, and so can the measurements of LCD_CALIBRATE. If LCD_SHORT_ATOMIC is defined, interrupts are
+ * only disabled while a nibble is put on the bus or the busy flag is read,
+ * i.e. for a few microseconds at a time. Interrupt handlers must not use the
+ * LCD in this mode, and neither should they in the default mode. 
+ * 
+ * If LCD_MAX_ATOMIC_US is defined, compilation fails if the driver could
+ * possibly keep interrupts disabled for longer than that many microseconds. 
+ * 
+ * If LCD_ATOMIC_TIMER is defined, it must name the counter register of a
+ * free-running timer (e.g. TCNT1). The driver then records the longest time
+ * it kept interrupts disabled in lcd_maxAtomicTicks (in ticks of that timer).
+ */
+//#define LCD_SHORT_ATOMIC
+//#define LCD_MAX_ATOMIC_US 10
+//#define LCD_ATOMIC_TIMER TCNT1
+
 /**
  * \brief Port and pin definitions
  * 
@@ -90,6 +154,39 @@
 #define DB7_REG_PIN PINB
 #define DB7_PIN 3
 
+/**
+ * \brief Use all eight data lines
+ * 
+ * By default, the LCD is operated in 4-bit mode, i.e. only DB[7:4] are
+ * connected and every byte is transferred as two nibbles. If you have enough
+ * free pins, define LCD_8BIT and assign DB[3:0] below. Each byte then takes
+ * only one transfer. If all eight data lines are connected to the same port in
+ * order (DB0 to P?0, ..., DB7 to P?7), a byte is written to the port in one
+ * go. 
+ */
+//#define LCD_8BIT
+
+// DB0..DB3 pins (only used if LCD_8BIT is defined)
+#define DB0_REG_DDR DDRC
+#define DB0_REG_PORT PORTC
+#define DB0_REG_PIN PINC
+#define DB0_PIN 0
+
+#define DB1_REG_DDR DDRC
+#define DB1_REG_PORT PORTC
+#define DB1_REG_PIN PINC
+#define DB1_PIN 1
+
+#define DB2_REG_DDR DDRC
+#define DB2_REG_PORT PORTC
+#define DB2_REG_PIN PINC
+#define DB2_PIN 2
+
+#define DB3_REG_DDR DDRC
+#define DB3_REG_PORT PORTC
+#define DB3_REG_PIN PINC
+#define DB3_PIN 3
+
 /**
  * \brief Redirect stdout and/or stderr to the LCD
  * 
@@ -100,6 +197,162 @@
 //#define LCD_NO_STDOUT_REDIRECT
 //#define LCD_NO_STDERR_REDIRECT
 
+/**
+ * \brief Character ROM
+ * 
+ * Most HD44780-compatible controllers have ROM A00, which contains ASCII
+ * (except for backslash and tilde), Katakana and a few Greek letters and
+ * symbols. Define LCD_ROM_A02 if yours has the Western ROM A02 instead, which
+ * contains all of ASCII and Latin-1 as well as some Greek and Cyrillic letters,
+ * arrows and other symbols. Unicode characters are mapped to the ROM
+ * accordingly. With A02, LCD_CC_TILDE and LCD_CC_BACKSLASH are not needed. 
+ */
+//#define LCD_ROM_A02
+
+/**
+ * \brief Shadow framebuffer
+ * 
+ * If LCD_FRAMEBUFFER is defined, the driver keeps a copy of the display
+ * contents in RAM (32 bytes). The writing functions then only modify this
+ * copy and mark the cells whose content has actually changed as dirty.
+ * Nothing is sent to the LCD until lcd_flush() is called, which transmits
+ * only the dirty cells and needs just one "Set DDRAM address" command per run
+ * of consecutive dirty cells. 
+ * This makes redrawing a mostly static screen very cheap. 
+ */
+//#define LCD_FRAMEBUFFER
+
+/**
+ * \brief Frame rate
+ * 
+ * If LCD_FRAME_RATE is defined (requires LCD_FRAMEBUFFER), lcd_tick() sends
+ * the changes in the framebuffer to the LCD LCD_FRAME_RATE times per second,
+ * provided it is called LCD_TICK_RATE times per second, e.g. from a timer
+ * interrupt. Text can then be written as often as the application likes, the
+ * LCD shows the latest state and the bus time per second stays bounded (at
+ * most 32 characters per frame). The LCD itself cannot show more than some
+ * 20 to 30 changes per second anyway. lcd_flush() still works, too. 
+ */
+//#define LCD_FRAME_RATE 25
+#define LCD_TICK_RATE 100
+
+/**
+ * \brief Asynchronous operation
+ * 
+ * If LCD_ASYNC is defined, commands and data are not sent to the LCD right
+ * away but put into a queue with room for LCD_ASYNC_QUEUE_SIZE bytes (must be
+ * a power of two, at most 128). The queue is emptied in the background by the
+ * compare match interrupt of Timer0, which sends one byte every
+ * LCD_ASYNC_TICK_US microseconds and waits as many ticks as the LCD needs to
+ * execute a command. This way, the writing functions return immediately
+ * unless the queue is full. 
+ * Timer0 must not be used for anything else and interrupts must be enabled
+ * globally (otherwise the queue is emptied synchronously whenever it is full).
+ * The busy flag is not polled in this mode. 
+ * Use lcd_queueDepth() and lcd_queueHighWater() to choose the queue size. 
+ */
+//#define LCD_ASYNC
+#define LCD_ASYNC_QUEUE_SIZE 64
+#define LCD_ASYNC_TICK_US 50
+
+/**
+ * \brief Custom character cache
+ * 
+ * If LCD_GLYPH_CACHE is defined, the CGRAM slots in LCD_GLYPH_CACHE_SLOTS
+ * (bit i for slot i) are managed by the driver. The application passes a
+ * table of glyphs to lcd_setGlyphTable() and then refers to them by their
+ * index. Glyphs are uploaded on first use and stay in CGRAM until the slot is
+ * needed for another glyph. The slot used least recently among those not
+ * currently on the screen is reused first. This way, any number of glyphs can
+ * be used over time, as long as no more than 8 are visible at once. 
+ * The driver keeps a copy of the display contents in RAM (32 bytes) to know
+ * which slots are visible. Leave the slots of LCD_CC_TILDE and
+ * LCD_CC_BACKSLASH out of LCD_GLYPH_CACHE_SLOTS. 
+ */
+//#define LCD_GLYPH_CACHE
+#define LCD_GLYPH_CACHE_SLOTS 0b11111001
+
+/**
+ * \brief Custom character animation
+ * 
+ * If LCD_ANIMATION is defined, up to LCD_ANIMATIONS custom characters can be
+ * animated in the background with lcd_animate(). The application has to call
+ * lcd_tick() periodically, e.g. from a timer interrupt, which then uploads
+ * the rows that differ from the previous frame whenever it is time to. 
+ */
+//#define LCD_ANIMATION
+#define LCD_ANIMATIONS 2
+
+/**
+ * \brief Charts in custom characters
+ * 
+ * If LCD_CHART is defined, lcd_writeChart() and lcd_updateChart() are
+ * available. They show a chart of LCD_CHART_WIDTH samples in LCD_CHART_CELLS
+ * characters (1..8) next to each other, which use the CGRAM slots
+ * LCD_CHART_CC to LCD_CHART_CC+LCD_CHART_CELLS-1. For all 8 slots, remove
+ * LCD_CC_TILDE and LCD_CC_BACKSLASH. 
+ */
+//#define LCD_CHART
+#define LCD_CHART_CC 3
+#define LCD_CHART_CELLS 5
+#define LCD_CHART_WIDTH (5 * (LCD_CHART_CELLS))
+
+/**
+ * \brief Marquee
+ * 
+ * If LCD_MARQUEE is defined, lcd_marquee() scrolls text through both lines
+ * in the background. Each step is done by lcd_tick() with the LCD's display
+ * shift command, plus two writes per line whose text is longer than 40
+ * characters. 
+ */
+//#define LCD_MARQUEE
+
+/**
+ * \brief Scrolling console
+ * 
+ * If LCD_CONSOLE is defined, writing beyond the end of the second line (or a
+ * '\n' in the second line followed by more output) does not clear the screen
+ * but moves the second line up. Only the cells whose content changes are
+ * sent. The line that disappears at the top goes into a scrollback buffer of
+ * LCD_CONSOLE_SCROLLBACK lines (16 bytes each), which can be browsed with
+ * lcd_scrollBack(). 
+ * The driver keeps a copy of the display contents in RAM (32 bytes). 
+ */
+//#define LCD_CONSOLE
+#define LCD_CONSOLE_SCROLLBACK 4
+
+/**
+ * \brief Fields
+ * 
+ * If LCD_FIELDS is defined, up to LCD_FIELDS (1..8) numeric fields can be
+ * declared with lcd_setFields() and then updated with lcd_setField() and
+ * lcd_updateFields(), which only sends the characters that have changed. 
+ * The driver keeps a copy of the display contents in RAM (32 bytes). 
+ */
+//#define LCD_FIELDS 4
+
+/**
+ * \brief Big digits across both lines
+ * 
+ * If LCD_BIG_DIGITS is defined, lcd_writeBigDec() is available. Its digits
+ * are made of segments in the CGRAM slots LCD_BIG_DIGITS_CC to
+ * LCD_BIG_DIGITS_CC+2 (+3 with LCD_ROM_A02). They are uploaded by lcd_init()
+ * and must not be used for anything else. 
+ */
+//#define LCD_BIG_DIGITS
+#define LCD_BIG_DIGITS_CC 3
+
+/**
+ * \brief Bar graphs with single-pixel resolution
+ * 
+ * If LCD_FINE_BAR is defined, lcd_drawFineBar() is available. It needs the
+ * CGRAM slots LCD_FINE_BAR_CC to LCD_FINE_BAR_CC+3 (+4 with LCD_ROM_A02) for
+ * partially filled cells. They are uploaded by lcd_init() and must not be
+ * used for anything else. 
+ */
+//#define LCD_FINE_BAR
+#define LCD_FINE_BAR_CC 3
+
 //=============================================================================
 // Public functions
 
@@ -114,6 +367,32 @@
  */
 void lcd_init(void);
 
+/**
+ * \brief Non-blocking alternative to lcd_init()
+ * 
+ * Does the next step of the initialisation and returns how many milliseconds
+ * to wait at least before calling it again, or 0 when the LCD is ready. The
+ * waits (about 22ms in total) can be used to bring up other parts of the
+ * system, e.g. from a 1ms timer tick: 
+ * 
+ * // +1 because the first tick may come right away
+ * uint8_t wait = lcd_initStep() + 1;
+ * ...
+ * // Once per millisecond
+ * if(wait && --wait == 0)
+ * {
+ *     wait = lcd_initStep();
+ *     if(wait)
+ *         wait++;
+ * }
+ * 
+ * Everything but the first step only takes some 100 microseconds (more if
+ * glyphs are uploaded). With LCD_WARM_START, the first call may already do
+ * all of the initialisation. No other function of this driver may be called until
+ * the LCD is ready. A call after that starts over. 
+ */
+uint8_t lcd_initStep(void);
+
 //-----------------------------------------------------------------------------
 // Cursor movement (Cursor determines where the next character is displayed)
 
@@ -201,7 +480,7 @@ void lcd_erase(uint8_t line);
  * cursor is moved to the next position. At the end of the first line, it wraps
  * around to the second line. When the end of the second line is reached, it
  * wraps around to the first one and before the next time a character is
- * written, the LCD is cleared automatically. 
+ * written, the LCD is cleared automatically (or scrolled, see LCD_CONSOLE). 
  * This goes for all writing functions. 
  * \param character The character to be written. There is rudimentary support
  * for UTF-8-encoded multi-byte characters. 
@@ -216,6 +495,36 @@ void lcd_writeChar(char character);
  */
 void lcd_writeString(const char *text);
 
+/**
+ * \brief Writes a number of characters
+ * 
+ * Like lcd_writeString() but the length is given and plain ASCII characters
+ * are sent without going through the UTF-8 decoder. 
+ * \param text The characters to be written (need not be 0-terminated)
+ * \param length Number of bytes in text
+ */
+void lcd_write(const char *text, uint8_t length);
+
+/**
+ * \brief Starts a batch of output
+ * 
+ * Disables interrupts until the matching lcd_endBatch(), so the transfers in
+ * between don't each have to disable and enable them again (and lcd_tick()
+ * stays away). This is meant for bulk updates of the screen where the
+ * application takes care of the interrupt latency itself: Each character
+ * takes about 50us, or as long as the LCD is busy with LCD_BUSY_TIMEOUT. 
+ * Batches may be nested. 
+ */
+void lcd_beginBatch(void);
+
+/**
+ * \brief Ends a batch of output started by lcd_beginBatch()
+ * 
+ * Interrupts are enabled again if they were before the outermost
+ * lcd_beginBatch(). Does nothing if there is no batch to end. 
+ */
+void lcd_endBatch(void);
+
 /**
  * \brief Writes a string from program memory
  * 
@@ -233,6 +542,16 @@ void lcd_writeProgString(const char *string);
  */
 void lcd_writeErrorProgString(const char *string);
 
+/**
+ * \brief Writes a string from program memory that has already been converted
+ * to the LCD's character set, e.g. by LCD_PSTR() from lcd_literal.h
+ * 
+ * The bytes are written as they are, except for '\n' which starts a new line
+ * as usual. Use 8 for custom character 0. 
+ * \param string Pointer to the string in program memory
+ */
+void lcd_writeRawProgString(const char *string);
+
 /**
  * \brief Writes a half byte (nibble) as a hexadecimal digit
  * 
@@ -278,6 +597,49 @@ void lcd_writeDec(uint16_t number);
  */
 void lcd_write32bitHex(uint32_t number);
 
+/**
+ * \brief Writes a four-byte unsigned integer using up to ten decimal digits
+ * 
+ * \param number The integer to be written. 
+ */
+void lcd_writeDec32(uint32_t number);
+
+/**
+ * \brief Writes a four-byte signed integer in decimal
+ * 
+ * \param number The integer to be written. 
+ */
+void lcd_writeSignedDec(int32_t number);
+
+/**
+ * \brief Writes a fixed-point number in decimal
+ * 
+ * \param value The number in units of 10^-decimals, e.g. millivolts with
+ * decimals=3. 
+ * \param decimals Number of digits after the decimal point (at most 10). 
+ */
+void lcd_writeFixed(int32_t value, uint8_t decimals);
+
+/**
+ * \brief Writes formatted output, like printf()
+ * 
+ * Much smaller and faster than printf(), but only supports %d, %u, %ld, %lu,
+ * %x, %lx, %c, %s, %S, and %% with an optional width (see formatPrint() in
+ * format.h). Using this instead of printf() keeps avr-libc's vfprintf() out
+ * of the program. 
+ * \param format The format string. 
+ */
+void lcd_printf(const char* format, ...);
+
+/**
+ * \brief Writes formatted output with the format string in program memory
+ * 
+ * Works the same as lcd_printf() except the format string is in program
+ * memory, e.g. lcd_printf_P(PSTR("%u%%"), percent). 
+ * \param format The format string in program memory. 
+ */
+void lcd_printf_P(const char* format, ...);
+
 /**
  * \brief Writes a non-negative voltage value with three fractional digits
  * 
@@ -299,6 +661,148 @@ void lcd_writeVoltage(uint16_t voltage, uint16_t valueUpperBound, uint8_t voltUp
  */
 void lcd_drawBar(uint8_t percent);
 
+#ifdef LCD_FINE_BAR
+/**
+ * \brief Draws a bar graph across a whole line with a resolution of one
+ * pixel column, i.e. 80 steps
+ * 
+ * Only the cells that differ from the bar drawn by the previous call for the
+ * same line are sent, which is typically one or two. For this to work,
+ * nothing else may be written into that line in between, except after
+ * lcd_clear() or lcd_erase(). The cursor is not moved. 
+ * Only available if LCD_FINE_BAR is defined. 
+ * \param row The line (1 or 2)
+ * \param level Number of filled pixel columns (0..80)
+ */
+void lcd_drawFineBar(uint8_t row, uint8_t level);
+#endif
+
+#ifdef LCD_BIG_DIGITS
+/**
+ * \brief Writes an unsigned integer in digits as high as both lines
+ * 
+ * Each digit is 3 columns wide and followed by an empty column, which is not
+ * written. The number is right-aligned in as many digits as fit between
+ * column and the end of the line (at most 4), leading zeros are left blank.
+ * If it does not fit, only the least significant digits are shown. 
+ * Only the cells that differ from the number written by the previous call
+ * are sent, as long as column is the same and neither lcd_clear() nor
+ * lcd_erase() has been called in between. The cursor is not moved. 
+ * Only available if LCD_BIG_DIGITS is defined. 
+ * \param value The integer to be written
+ * \param column Column of the first digit (1..14)
+ */
+void lcd_writeBigDec(uint16_t value, uint8_t column);
+#endif
+
+/**
+ * \brief Sends all changes made since the last call to the LCD
+ * 
+ * Only has an effect if LCD_FRAMEBUFFER is defined. In that case, nothing
+ * written by any of the writing functions becomes visible until this function
+ * is called. 
+ */
+void lcd_flush(void);
+
+#ifdef LCD_CONSOLE
+/**
+ * \brief Shows the console as it was a number of lines ago
+ * 
+ * Call this e.g. when buttons for scrolling up and down are pressed. Writing
+ * text returns to the current output. 
+ * Only available if LCD_CONSOLE is defined. 
+ * \param lines Number of lines to scroll back, 0 for the current output
+ * \return The number of lines actually scrolled back, which is less than
+ * lines if the scrollback does not go back that far
+ */
+uint8_t lcd_scrollBack(uint8_t lines);
+#endif
+
+#ifdef LCD_FIELDS
+//-----------------------------------------------------------------------------
+// Fields
+
+/**
+ * \brief Descriptor of a field, see LCD_FIELD()
+ */
+typedef struct
+{
+	uint8_t cell;		// Position of the first character (like lcdCursor)
+	uint8_t width;		// Number of characters
+	uint8_t decimals;	// Number of digits after the decimal point
+} lcd_field_t;
+
+/**
+ * \brief Initialiser for a field descriptor
+ * 
+ * Example: 
+ * static const lcd_field_t fields[] PROGMEM = {
+ *     LCD_FIELD(2, 1, 8, 0),	// Integer in line 2, columns 1..8
+ *     LCD_FIELD(1, 12, 5, 2)	// -9.99..99.99 in line 1, columns 12..16
+ * };
+ * The field has to fit into its line and have at most 10 decimals. With
+ * constant arguments, this is checked at compile time ("size of array is
+ * negative"). 
+ * \param row The line (1 or 2)
+ * \param column The column of the first character (1..16)
+ * \param width Number of characters, the value is right-aligned in them
+ * \param decimals Number of digits after the decimal point (at most 10), see
+ * lcd_writeFixed()
+ */
+#define LCD_FIELD(row, column, width, decimals) \
+	{(uint8_t)(((((row) - 1) << 4) | ((column) - 1)) \
+	           + 0 * sizeof(char[LCD_FIELD_MISFIT(row, column, width, decimals) ? -1 : 1])), \
+	 (width), (decimals)}
+
+/**
+ * \brief True if the arguments of LCD_FIELD() are constant and the field
+ * doesn't fit into its line or has too many decimals
+ */
+#define LCD_FIELD_MISFIT(row, column, width, decimals) \
+	(__builtin_constant_p((row) * 256 + (column) + (width) + (decimals)) \
+	 && ((row) < 1 || (row) > 2 || (column) < 1 || (column) - 1 + (width) > 16 \
+	     || (decimals) > 10))
+
+/**
+ * \brief Declares the fields on the screen
+ * 
+ * The fields are drawn by the next lcd_updateFields(). Fields that don't fit
+ * into their line or have more than 10 decimals are ignored. Only available if LCD_FIELDS is defined. 
+ * \param fields_P Pointer to the descriptors in program memory
+ * \param count Number of fields (at most LCD_FIELDS)
+ */
+void lcd_setFields(const lcd_field_t* fields_P, uint8_t count);
+
+/**
+ * \brief Sets the value of a field
+ * 
+ * Doesn't talk to the LCD, so it is cheap and may be called from interrupts.
+ * The new value becomes visible with the next lcd_updateFields(). 
+ * Only available if LCD_FIELDS is defined. 
+ * \param index Index of the field in the descriptors
+ * \param value The new value, in units of 10^-decimals
+ */
+void lcd_setField(uint8_t index, int32_t value);
+
+/**
+ * \brief Draws the fields whose value has changed
+ * 
+ * Only the characters that differ from what is on the screen are sent. Values
+ * that don't fit into their field are shown as '#'. This doesn't move the
+ * cursor. Only available if LCD_FIELDS is defined. 
+ */
+void lcd_updateFields(void);
+
+/**
+ * \brief Number of characters lcd_updateFields() did not have to send
+ * because they were already on the screen
+ * 
+ * A full redraw would have sent these, too (plus one "Set DDRAM address"
+ * command per field). Only available if LCD_FIELDS is defined. 
+ */
+extern uint32_t lcd_fieldsSaved;
+#endif
+
 //-----------------------------------------------------------------------------
 // Custom characters
 
@@ -363,6 +867,130 @@ void lcd_drawBar(uint8_t percent);
  */
 void lcd_registerCustomChar(uint8_t addr, uint64_t chr);
 
+/**
+ * \brief Registers several custom characters stored in program memory
+ * 
+ * Much cheaper than calling lcd_registerCustomChar() for each of them, since
+ * the whole set is sent in one go. 
+ * \param firstAddr The address of the first character. 
+ * \param glyphs_P Pointer to the bitmaps in program memory. Each character
+ * takes 8 bytes, one per row from top to bottom (like in CUSTOM_CHAR()). 
+ * \param count Number of characters. firstAddr + count must not exceed 8. 
+ */
+void lcd_registerCustomChars_P(uint8_t firstAddr, const uint8_t* glyphs_P, uint8_t count);
+
+#ifdef LCD_GLYPH_CACHE
+/**
+ * \brief Sets the table of glyphs used by lcd_glyph() and lcd_writeGlyph()
+ * 
+ * The table is in program memory and consists of 8 bytes per glyph, one per
+ * row from top to bottom (the same layout as CUSTOM_CHAR()). Glyph n starts at
+ * byte 8*n, IDs go up to 254. Any glyphs from a previous table are forgotten. 
+ * \param table Pointer to the table in program memory
+ */
+void lcd_setGlyphTable(const uint8_t* table);
+
+/**
+ * \brief Makes sure a glyph is in CGRAM
+ * 
+ * \param id Index of the glyph in the table set by lcd_setGlyphTable()
+ * \return The character code (0..7) under which the glyph can be written with
+ * lcd_writeChar(). Only valid until the next call to lcd_glyph() or
+ * lcd_writeGlyph() unless the character has been written to the screen by
+ * then. If the glyph is not in CGRAM and all slots are in use by glyphs on
+ * the screen, LCD_CHARMAP_UNKNOWN is returned instead. With
+ * LCD_FRAMEBUFFER, overwritten glyphs stay in use until the next flush.
+ */
+uint8_t lcd_glyph(uint8_t id);
+
+/**
+ * \brief Writes a glyph at the current cursor position
+ * 
+ * Uploads the glyph to CGRAM first if necessary. If there is no slot for it
+ * (see lcd_glyph()), LCD_CHARMAP_UNKNOWN is written instead. 
+ * \param id Index of the glyph in the table set by lcd_setGlyphTable()
+ */
+void lcd_writeGlyph(uint8_t id);
+#endif
+
+#ifdef LCD_ANIMATION
+/**
+ * \brief Animates a custom character in the background
+ * 
+ * The frames are uploaded by lcd_tick(), one after the other, starting over
+ * after the last one. Only the rows that differ from the previous frame are
+ * sent. Calling this again for the same address replaces the animation. 
+ * Only available if LCD_ANIMATION is defined. 
+ * \param addr The address of the custom character (0..7). Don't use it for
+ * anything else while it is animated. 
+ * \param frames_P Pointer to the frames in program memory. Each frame takes 8
+ * bytes, one per row from top to bottom (like in CUSTOM_CHAR()). 
+ * \param count Number of frames. 0 stops the animation, leaving the current
+ * frame in place. 
+ * \param period Number of calls to lcd_tick() per frame
+ */
+void lcd_animate(uint8_t addr, const uint8_t* frames_P, uint8_t count, uint8_t period);
+#endif
+
+#ifdef LCD_MARQUEE
+/**
+ * \brief Scrolls text through both lines from right to left in the
+ * background
+ * 
+ * The LCD has 40 columns of memory per line, of which 16 are visible. The text
+ * is loaded into them once, after that each step just shifts the display,
+ * which moves both lines. Text longer than 40 characters is refilled one
+ * column at a time outside of the visible area. Shorter text is followed by
+ * spaces up to 40 characters. The text loops around, add spaces at its end
+ * if it should not follow itself immediately. 
+ * While the marquee is running, the display shows nothing else. lcd_clear()
+ * stops it. 
+ * Only available if LCD_MARQUEE is defined. 
+ * \param line1_P Text of the first line in program memory (up to 255
+ * characters, or 0 for none). The characters are sent as they are, like
+ * lcd_writeRawProgString() does. 
+ * \param line2_P Text of the second line, likewise
+ * \param period Number of calls to lcd_tick() per step
+ */
+void lcd_marquee(const char* line1_P, const char* line2_P, uint8_t period);
+#endif
+
+#if (defined LCD_ANIMATION) || (defined LCD_MARQUEE) || (defined LCD_FRAME_RATE)
+/**
+ * \brief Does the background work of the driver, e.g. animations
+ * 
+ * Call this periodically, either from the main loop or from a timer
+ * interrupt. If it interrupts the driver while it is talking to the LCD, it
+ * returns without doing anything (and the tick is lost). 
+ * Only available if LCD_ANIMATION, LCD_MARQUEE or LCD_FRAME_RATE is defined. 
+ */
+void lcd_tick(void);
+#endif
+
+#ifdef LCD_CHART
+/**
+ * \brief Writes the characters that show the chart at the cursor position
+ * 
+ * This only needs to be done once, lcd_updateChart() then changes the
+ * characters themselves. 
+ * Only available if LCD_CHART is defined. 
+ */
+void lcd_writeChart(void);
+
+/**
+ * \brief Draws a chart of samples into the chart characters
+ * 
+ * Each sample is a column of pixels growing from the bottom. Only the pixel
+ * rows that differ from the previous chart are sent to the LCD. 
+ * Only available if LCD_CHART is defined. 
+ * \param samples Ring buffer of LCD_CHART_WIDTH samples, each the height of
+ * its column in pixels (0..8)
+ * \param first Index of the oldest sample in samples, which is shown on the
+ * left
+ */
+void lcd_updateChart(const uint8_t* samples, uint8_t first);
+#endif
+
 
 //-----------------------------------------------------------------------------
 // Miscellaneous
@@ -383,5 +1011,193 @@ extern FILE* lcdout;
  */
 void lcd_command(uint8_t command);
 
+#ifdef LCD_CALIBRATE
+
+/**
+ * \brief Execution times of the LCD in microseconds as measured by lcd_init()
+ * 
+ * A value of 0 means the measurement failed (e.g. because R/W is not
+ * connected) and the datasheet value is used instead. 
+ * Only available if LCD_CALIBRATE is defined. 
+ */
+typedef struct
+{
+	uint16_t data;		// Writing a character (datasheet: 46us)
+	uint16_t command;	// "Set DDRAM address" (datasheet: 42us)
+	uint16_t clear;		// "Clear display" (datasheet: 1640us)
+} lcd_timing_t;
+extern lcd_timing_t lcd_timing;
+
+#endif
+
+#ifdef LCD_ATOMIC_TIMER
+
+/**
+ * \brief Longest time the driver kept interrupts disabled so far, measured in
+ * ticks of LCD_ATOMIC_TIMER
+ * 
+ * Only available if LCD_ATOMIC_TIMER is defined. Reset it to 0 to start a new
+ * measurement. 
+ */
+extern uint16_t lcd_maxAtomicTicks;
+
+#endif
+
+#ifdef LCD_ASYNC
+
+/**
+ * \brief Returns the number of bytes currently waiting in the queue
+ * 
+ * Only available if LCD_ASYNC is defined. 
+ */
+uint8_t lcd_queueDepth(void);
+
+/**
+ * \brief Returns the largest number of bytes that were ever waiting in the
+ * queue at the same time
+ * 
+ * Only available if LCD_ASYNC is defined. If this gets close to
+ * LCD_ASYNC_QUEUE_SIZE, consider increasing the queue size. 
+ */
+uint8_t lcd_queueHighWater(void);
+
+#endif
+
+//=============================================================================
+// Character mapping
+
+/*
+ * Unicode characters that are not simply at the position of their code point
+ * in the LCD's character ROM. Used by lcd_writeChar() and, at compile time, by
+ * LCD_PSTR() (see lcd_literal.h). 
+ * LCD_CHARMAP(X) expands to X(codePoint, lcdCode) for each of them, sorted by
+ * code point. Code points that are not listed are displayed as themselves up
+ * to LCD_CHARMAP_IDENTITY_MAX and as LCD_CHARMAP_UNKNOWN above. 
+ */
+#ifdef LCD_CC_BACKSLASH
+#define LCD_CHARMAP_BACKSLASH(X) X(0x005c, LCD_CC_BACKSLASH) /* Backslash */
+#else
+#define LCD_CHARMAP_BACKSLASH(X)
+#endif
+#ifdef LCD_CC_TILDE
+#define LCD_CHARMAP_TILDE(X) X(0x007e, LCD_CC_TILDE) /* Tilde ~ */
+#else
+#define LCD_CHARMAP_TILDE(X)
+#endif
+#ifdef LCD_CC_IXI
+#define LCD_CHARMAP_IXI(X) X(0x217a, LCD_CC_IXI) /* IXI department logo (ⅺ) */
+#else
+#define LCD_CHARMAP_IXI(X)
+#endif
+
+#ifndef LCD_ROM_A02
+// ROM A00 (Japanese) has ASCII except for backslash and tilde, the rest are
+// Katakana and a few symbols. 
+#define LCD_CHARMAP(X) \
+	LCD_CHARMAP_BACKSLASH(X) \
+	LCD_CHARMAP_TILDE(X) \
+	X(0x009d, 0x5c) /* The Yen sign (¥) is where the backslash is supposed to be */ \
+	X(0x00a2, 0xec) /* Cent sign (¢) */ \
+	X(0x00b0, 0xdf) /* Degree sign (°) */ \
+	X(0x00b5, 0xe4) /* Micro sign (µ) */ \
+	X(0x00b7, 0xa5) /* Middle dot (·) */ \
+	X(0x00d9, 0xa3) /* Single down and right (┌) */ \
+	X(0x00da, 0xa2) /* Single up and left (┘) */ \
+	X(0x00df, 0xe2) /* German Eszett (ß) */ \
+	X(0x00e4, 0xe1) /* Lowercase umlaut a (ä) */ \
+	X(0x00f1, 0xee) /* Lowercase n with tilde (ñ) */ \
+	X(0x00f6, 0xef) /* Lowercase umlaut o (ö) */ \
+	X(0x00f7, 0xfd) /* Division sign (÷) */ \
+	X(0x00fc, 0xf5) /* Lowercase umlaut u (ü) */ \
+	X(0x018e, 0xae) /* Existential quantifier (∃) */ \
+	X(0x0190, 0xe3) /* Lowercase epsilon (ε) */ \
+	X(0x03a3, 0xf6) /* Uppercase sigma (Σ) */ \
+	X(0x03a9, 0xf4) /* Uppercase omega (Ω) */ \
+	X(0x03b1, 0xe0) /* Lowercase alpha (α) */ \
+	X(0x03b2, 0xe2) /* Lowercase beta (β) */ \
+	X(0x03b5, 0xe3) /* Lowercase epsilon (ε) */ \
+	X(0x03b8, 0xf2) /* Lowercase theta (θ) */ \
+	X(0x03bc, 0xe4) /* Lowercase mu (μ) */ \
+	X(0x03c0, 0xf7) /* Lowercase pi (π) */ \
+	X(0x03c1, 0xe6) /* Lowercase rho (ρ) */ \
+	X(0x03c3, 0xe5) /* Lowercase sigma (σ) */ \
+	X(0x2092, 0xa1) /* Subscript small o (ₒ) */ \
+	X(0x215f, 0xe9) /* Inverse Symbol (no unicode equivalent, we'll use ⅟ instead) */ \
+	LCD_CHARMAP_IXI(X) \
+	X(0x2190, 0x7f) /* Left arrow (←) */ \
+	X(0x2192, 0x7e) /* The right arrow (→) is where the tilde is supposed to be */ \
+	X(0x2203, 0xae) /* Existential quantifier (∃) */ \
+	X(0x221a, 0xe8) /* Square root symbol (√) */ \
+	X(0x221e, 0xf3) /* Infinity symbol (∞) */ \
+	X(0x25a0, 0xff) /* Black square (■) */ \
+	X(0x25a1, 0xdb) /* White square (□) */ \
+	X(0x25ae, 0xff) /* Vertical black rectangle (▮) */ \
+	X(0x25af, 0xdb) /* Vertical white rectangle (▯) */
+#define LCD_CHARMAP_IDENTITY_MAX 0x80
+#define LCD_CHARMAP_UNKNOWN 0xff
+#else
+// ROM A02 (Western) has all of ASCII and, from 0xa0 on, Latin-1. Below the
+// space, it has arrows and other symbols, and 0x80..0x9f hold Cyrillic and
+// Greek letters and more symbols. Of those, all but the bell (0x98) are
+// listed here. 
+#define LCD_CHARMAP(X) \
+	X(0x0393, 0x92) /* Uppercase gamma (Γ) */ \
+	X(0x0398, 0x99) /* Uppercase theta (Θ) */ \
+	X(0x03a3, 0x94) /* Uppercase sigma (Σ) */ \
+	X(0x03a9, 0x9a) /* Uppercase omega (Ω) */ \
+	X(0x03b1, 0x90) /* Lowercase alpha (α) */ \
+	X(0x03b4, 0x9b) /* Lowercase delta (δ) */ \
+	X(0x03b5, 0x9e) /* Lowercase epsilon (ε) */ \
+	X(0x03bc, 0xb5) /* Lowercase mu (μ), same as the micro sign */ \
+	X(0x03c0, 0x93) /* Lowercase pi (π) */ \
+	X(0x03c3, 0x95) /* Lowercase sigma (σ) */ \
+	X(0x03c4, 0x97) /* Lowercase tau (τ) */ \
+	X(0x0411, 0x80) /* Cyrillic uppercase be (Б) */ \
+	X(0x0414, 0x81) /* Cyrillic uppercase de (Д) */ \
+	X(0x0416, 0x82) /* Cyrillic uppercase zhe (Ж) */ \
+	X(0x0417, 0x83) /* Cyrillic uppercase ze (З) */ \
+	X(0x0418, 0x84) /* Cyrillic uppercase i (И) */ \
+	X(0x0419, 0x85) /* Cyrillic uppercase short i (Й) */ \
+	X(0x041b, 0x86) /* Cyrillic uppercase el (Л) */ \
+	X(0x041f, 0x87) /* Cyrillic uppercase pe (П) */ \
+	X(0x0423, 0x88) /* Cyrillic uppercase u (У) */ \
+	X(0x0426, 0x89) /* Cyrillic uppercase tse (Ц) */ \
+	X(0x0427, 0x8a) /* Cyrillic uppercase che (Ч) */ \
+	X(0x0428, 0x8b) /* Cyrillic uppercase sha (Ш) */ \
+	X(0x0429, 0x8c) /* Cyrillic uppercase shcha (Щ) */ \
+	X(0x042a, 0x8d) /* Cyrillic uppercase hard sign (Ъ) */ \
+	X(0x042b, 0x8e) /* Cyrillic uppercase yeru (Ы) */ \
+	X(0x042d, 0x8f) /* Cyrillic uppercase e (Э) */ \
+	X(0x201c, 0x12) /* Left double quotation mark (“) */ \
+	X(0x201d, 0x13) /* Right double quotation mark (”) */ \
+	LCD_CHARMAP_IXI(X) \
+	X(0x2190, 0x1b) /* Left arrow (←) */ \
+	X(0x2191, 0x18) /* Up arrow (↑) */ \
+	X(0x2192, 0x1a) /* Right arrow (→) */ \
+	X(0x2193, 0x19) /* Down arrow (↓) */ \
+	X(0x21b5, 0x17) /* Return arrow (↵) */ \
+	X(0x221e, 0x9c) /* Infinity symbol (∞) */ \
+	X(0x2229, 0x9f) /* Intersection (∩) */ \
+	X(0x2264, 0x1c) /* Less-than or equal to (≤) */ \
+	X(0x2265, 0x1d) /* Greater-than or equal to (≥) */ \
+	X(0x2302, 0x7f) /* House (⌂) */ \
+	X(0x23eb, 0x14) /* Double up arrow (⏫) */ \
+	X(0x23ec, 0x15) /* Double down arrow (⏬) */ \
+	X(0x25b2, 0x1e) /* Up-pointing triangle (▲) */ \
+	X(0x25b6, 0x10) /* Right-pointing triangle (▶) */ \
+	X(0x25bc, 0x1f) /* Down-pointing triangle (▼) */ \
+	X(0x25c0, 0x11) /* Left-pointing triangle (◀) */ \
+	X(0x25cf, 0x16) /* Black circle (●) */ \
+	X(0x2665, 0x9d) /* Heart (♥) */ \
+	X(0x266a, 0x91) /* Eighth note (♪) */ \
+	X(0x266b, 0x96) /* Beamed eighth notes (♫) */
+#define LCD_CHARMAP_IDENTITY_MAX 0xff
+#define LCD_CHARMAP_UNKNOWN '?'
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
@@ -0,0 +1,174 @@
+/**
+ * \file lcd_literal.h
+ * \brief Compile-time conversion of string literals to the LCD's character set
+ *
+ * lcd_writeChar() decodes UTF-8 and maps every character to the LCD's
+ * character ROM at runtime. For constant strings, this work can be done by
+ * the compiler instead: LCD_PSTR("Umlaut: äöü") puts the already converted
+ * string into program memory, where it takes one byte per character instead
+ * of up to four. Write it with lcd_writeRawProgString().
+ *
+ * Since C has no way of running code at compile time, this header requires
+ * C++ (C++14 or later, e.g. avr-g++ -std=gnu++14). The conversion uses the
+ * same table (LCD_CHARMAP) and the same configuration as lcd_writeChar(), so
+ * both produce identical output.
+ */
+
+#ifndef _LCD_LITERAL_H
+#define _LCD_LITERAL_H
+
+#ifndef __cplusplus
+#error "lcd_literal.h can only be used from C++"
+#endif
+
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lcd.h"
+
+namespace lcd_literal
+{
+	/**
+	 * \brief Entry of charmap[]
+	 */
+	struct CharmapEntry
+	{
+		uint16_t codePoint;
+		uint8_t lcdCode;
+	};
+
+	/**
+	 * \brief Same as the table used by lcd_writeChar(), but usable at compile
+	 * time
+	 */
+#define LCD_LITERAL_ENTRY(codePoint, lcdCode) {codePoint, lcdCode},
+	constexpr CharmapEntry charmap[] = {
+		LCD_CHARMAP(LCD_LITERAL_ENTRY)
+		{0xffff, 0} // Sentinel, keeps the table from being empty
+	};
+#undef LCD_LITERAL_ENTRY
+
+	/**
+	 * \brief Maps a Unicode code point to a character of the LCD
+	 */
+	constexpr uint8_t mapCodePoint(uint32_t codePoint)
+	{
+		// The last entry is the sentinel
+		for(size_t i = 0; i + 1 < sizeof(charmap) / sizeof(charmap[0]); i++)
+			if(charmap[i].codePoint == codePoint)
+				// Custom character 0 would end the string, use its mirror
+				return charmap[i].lcdCode == 0 ? 8 : charmap[i].lcdCode;
+		if(codePoint <= LCD_CHARMAP_IDENTITY_MAX)
+			return (uint8_t)codePoint;
+		return LCD_CHARMAP_UNKNOWN;
+	}
+
+	/**
+	 * \brief UTF-8 decoder
+	 *
+	 * Invalid bytes are handled the same way as in lcd_writeChar().
+	 */
+	struct Decoder
+	{
+		uint32_t codePoint = 0;
+		uint8_t pending = 0;
+
+		/**
+		 * \brief Processes the next byte
+		 * \return true if a character is complete, which is then in codePoint
+		 */
+		constexpr bool feed(uint8_t c)
+		{
+			if(c < 0x80)
+			{
+				pending = 0;
+				codePoint = c;
+				return true;
+			}
+			else if((c & 0xc0) == 0x80)
+			{
+				// Continuation byte, ignored if stray
+				if(!pending)
+					return false;
+				codePoint = (codePoint << 6) | (c & 0x3f);
+				return !--pending;
+			}
+			else if((c & 0xe0) == 0xc0)
+			{
+				codePoint = c & 0x1f;
+				pending = 1;
+			}
+			else if((c & 0xf0) == 0xe0)
+			{
+				codePoint = c & 0x0f;
+				pending = 2;
+			}
+			else if((c & 0xf8) == 0xf0)
+			{
+				codePoint = c & 0x07;
+				pending = 3;
+			}
+			else
+			{
+				pending = 0;
+				codePoint = 0xfffd;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	/**
+	 * \brief Counts the characters of a UTF-8 string literal
+	 */
+	template<size_t N>
+	constexpr size_t length(const char (&text)[N])
+	{
+		Decoder decoder;
+		size_t count = 0;
+		// The last byte is the terminating 0
+		for(size_t i = 0; i + 1 < N; i++)
+			if(decoder.feed(text[i]))
+				count++;
+		return count;
+	}
+
+	/**
+	 * \brief A converted string, including the terminating 0
+	 */
+	template<size_t N>
+	struct String
+	{
+		char data[N + 1];
+	};
+
+	/**
+	 * \brief Converts a UTF-8 string literal with M characters
+	 */
+	template<size_t M, size_t N>
+	constexpr String<M> convert(const char (&text)[N])
+	{
+		Decoder decoder;
+		String<M> result = {};
+		size_t count = 0;
+		for(size_t i = 0; i + 1 < N; i++)
+			if(decoder.feed(text[i]))
+				result.data[count++] = (char)mapCodePoint(decoder.codePoint);
+		return result;
+	}
+}
+
+/**
+ * \brief Puts a UTF-8 string literal into program memory, already converted
+ * to the LCD's character set
+ *
+ * Works like PSTR(), but the result must be written with
+ * lcd_writeRawProgString() instead of lcd_writeProgString().
+ */
+#define LCD_PSTR(s) (__extension__({ \
+	static constexpr ::lcd_literal::String<::lcd_literal::length(s)> lcdLiteral PROGMEM \
+		= ::lcd_literal::convert<::lcd_literal::length(s)>(s); \
+	&lcdLiteral.data[0]; \
+}))
+
+#endif
@@ -4,6 +4,8 @@
  */
 
 #include<avr/io.h>
+#include<avr/pgmspace.h>
+#include"format.h"
 #include"serial.h"
 
 // Check if F_CPU is defined
@@ -72,6 +74,53 @@ void serialFlush()
 	while(!(UCSR0A & (1 << TXC0)));
 }
 
+void serialTransmitString(const char* text)
+{
+	while(*text)
+		serialTransmit(*text++);
+}
+
+void serialTransmitProgString(const char* text)
+{
+	char c;
+	while((c = pgm_read_byte(text++)))
+		serialTransmit(c);
+}
+
+void serialTransmitDec(uint32_t number)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	serialTransmitString(formatDec32(buffer, number));
+}
+
+void serialTransmitSignedDec(int32_t number)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	serialTransmitString(formatSignedDec32(buffer, number));
+}
+
+void serialTransmitFixed(int32_t value, uint8_t decimals)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	serialTransmitString(formatFixed(buffer, value, decimals));
+}
+
+void serialPrintf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	formatPrint(serialTransmit, format, args);
+	va_end(args);
+}
+
+void serialPrintf_P(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	formatPrint_P(serialTransmit, format, args);
+	va_end(args);
+}
+
 /**
  * \brief Helper function for stdio
  */
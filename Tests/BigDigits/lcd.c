@@ -0,0 +1,3054 @@
+/**
+ * \file lcd.c
+ * \brief AVR driver for HD44780-compatible 2x16 LCDs with 5x7 characters
+ * \see https://cdn-shop.adafruit.com/datasheets/HD44780.pdf
+ *
+ * This driver can use either delays or read the busy flag to determine whether
+ * the LCD can accept new commands or data. In order to work without delays,
+ * the R/W line must be connected. Alternatively, everything can be queued and
+ * sent in the background by a timer interrupt (see LCD_ASYNC in lcd.h). 
+ * It operates in 4-bit mode, meaning the DB[3:0] lines are not used, unless
+ * LCD_8BIT is defined in lcd.h. All lines can be connected to arbitrary GPIO
+ * pins of the AVR. The following pins are used:
+ * - RS
+ * - EN
+ * - R/W
+ * - DB[7:4]
+ * - DB[3:0] (only in 8-bit mode)
+ */
+
+#include<avr/io.h>
+#include<avr/interrupt.h>
+#include<avr/pgmspace.h>
+#include<util/atomic.h>
+#include"format.h"
+#include"lcd.h"
+
+//=============================================================================
+// Driver configuration
+
+/*
+ * For microsecond delays, the driver makes use of the _delay_us() function
+ * from util/delay.h which means F_CPU must be defined and have the correct
+ * value (CPU frequency in Mhz). 
+ */
+#ifdef F_CPU
+#include<util/delay.h>
+#else
+#error "F_CPU is not defined"
+#endif
+
+/*
+ * For millisecond delays, _delay_ms() is used by default but if another option
+ * (e.g. timer-based) has been defined, that is preferred. 
+ */
+#ifndef delayMs
+#define delayMs(TIME) _delay_ms(TIME)
+#endif
+
+/*
+ * If ports and pins have been selected in the header file, use those. 
+ * Otherwise they can be chosen individually. 
+ */
+#if defined LCD_PORT_DDR && defined LCD_PORT_DATA && defined LCD_PIN
+// Use predefined port and default pins
+#define RS_REG_DDR LCD_PORT_DDR
+#define RS_REG_PORT LCD_PORT_DATA
+#define RS_PIN 4
+#define RW_REG_DDR LCD_PORT_DDR
+#define RW_REG_PORT LCD_PORT_DATA
+#define RW_PIN 6
+#define EN_REG_DDR LCD_PORT_DDR
+#define EN_REG_PORT LCD_PORT_DATA
+#define EN_PIN 5
+#define DB4_REG_DDR LCD_PORT_DDR
+#define DB4_REG_PORT LCD_PORT_DATA
+#define DB4_REG_PIN LCD_PIN
+#define DB4_PIN 0
+#define DB5_REG_DDR LCD_PORT_DDR
+#define DB5_REG_PORT LCD_PORT_DATA
+#define DB5_REG_PIN LCD_PIN
+#define DB5_PIN 1
+#define DB6_REG_DDR LCD_PORT_DDR
+#define DB6_REG_PORT LCD_PORT_DATA
+#define DB6_REG_PIN LCD_PIN
+#define DB6_PIN 2
+#define DB7_REG_DDR LCD_PORT_DDR
+#define DB7_REG_PORT LCD_PORT_DATA
+#define DB7_REG_PIN LCD_PIN
+#define DB7_PIN 3
+#endif
+
+// Make sure everything is defined
+#if !(defined RS_REG_DDR) || !(defined RS_REG_PORT) || !(defined RS_PIN)
+#error "The RS port and/or pin was not defined"
+#endif
+
+#if (defined LCD_BUSY_TIMEOUT) && (!(defined RW_REG_DDR) || !(defined RW_REG_PORT) || !(defined RW_PIN))
+#error "The RW port and/or pin was not defined"
+#endif
+
+#if !(defined EN_REG_DDR) || !(defined EN_REG_PORT) || !(defined EN_PIN)
+#error "The EN port and/or pin was not defined"
+#endif
+
+#if !(defined DB4_REG_DDR) || !(defined DB4_REG_PORT) || !(defined DB4_PIN)
+#error "The DB4 port and/or pin was not defined"
+#endif
+
+#if !(defined DB5_REG_DDR) || !(defined DB5_REG_PORT) || !(defined DB5_PIN)
+#error "The DB5 port and/or pin was not defined"
+#endif
+
+#if !(defined DB6_REG_DDR) || !(defined DB6_REG_PORT) || !(defined DB6_PIN)
+#error "The DB6 port and/or pin was not defined"
+#endif
+
+#if !(defined DB7_REG_DDR) || !(defined DB7_REG_PORT) || !(defined DB7_PIN)
+#error "The DB7 port and/or pin was not defined"
+#endif
+
+#ifdef LCD_8BIT
+#if !(defined DB0_REG_DDR) || !(defined DB0_REG_PORT) || !(defined DB0_PIN)
+#error "The DB0 port and/or pin was not defined"
+#endif
+
+#if !(defined DB1_REG_DDR) || !(defined DB1_REG_PORT) || !(defined DB1_PIN)
+#error "The DB1 port and/or pin was not defined"
+#endif
+
+#if !(defined DB2_REG_DDR) || !(defined DB2_REG_PORT) || !(defined DB2_PIN)
+#error "The DB2 port and/or pin was not defined"
+#endif
+
+#if !(defined DB3_REG_DDR) || !(defined DB3_REG_PORT) || !(defined DB3_PIN)
+#error "The DB3 port and/or pin was not defined"
+#endif
+#endif
+
+#ifdef LCD_CALIBRATE
+#if (defined LCD_BUSY_TIMEOUT) || (defined LCD_ASYNC)
+#error "LCD_CALIBRATE cannot be combined with LCD_BUSY_TIMEOUT or LCD_ASYNC"
+#endif
+#if !(defined RW_REG_DDR) || !(defined RW_REG_PORT) || !(defined RW_PIN)
+#error "The RW port and/or pin was not defined"
+#endif
+#include<util/delay_basic.h>
+#endif
+
+#if (defined LCD_WARM_START) && (!(defined RW_REG_DDR) || !(defined RW_REG_PORT) || !(defined RW_PIN))
+#error "The RW port and/or pin was not defined"
+#endif
+
+// Some features need to know what is on the screen
+#if (defined LCD_FRAMEBUFFER) || (defined LCD_GLYPH_CACHE) || (defined LCD_CONSOLE) || (defined LCD_FIELDS)
+#define SHADOW
+#endif
+
+// Some features need lcd_tick()
+#if (defined LCD_ANIMATION) || (defined LCD_MARQUEE) || (defined LCD_FRAME_RATE)
+#define TICK
+#endif
+
+#ifdef LCD_FRAME_RATE
+#ifndef LCD_FRAMEBUFFER
+#error "LCD_FRAME_RATE requires LCD_FRAMEBUFFER"
+#endif
+// Number of calls to lcd_tick() per frame
+#define FRAME_TICKS ((LCD_TICK_RATE) / (LCD_FRAME_RATE))
+#if FRAME_TICKS < 1 || FRAME_TICKS > 255
+#error "LCD_TICK_RATE / LCD_FRAME_RATE must be between 1 and 255"
+#endif
+#endif
+
+#ifdef LCD_GLYPH_CACHE
+#if (defined LCD_CC_TILDE) && ((LCD_GLYPH_CACHE_SLOTS) & (1 << (LCD_CC_TILDE)))
+#error "LCD_GLYPH_CACHE_SLOTS must not include LCD_CC_TILDE"
+#endif
+#if (defined LCD_CC_BACKSLASH) && ((LCD_GLYPH_CACHE_SLOTS) & (1 << (LCD_CC_BACKSLASH)))
+#error "LCD_GLYPH_CACHE_SLOTS must not include LCD_CC_BACKSLASH"
+#endif
+#if (defined LCD_CC_IXI) && ((LCD_GLYPH_CACHE_SLOTS) & (1 << (LCD_CC_IXI)))
+#error "LCD_GLYPH_CACHE_SLOTS must not include LCD_CC_IXI"
+#endif
+#if !((LCD_GLYPH_CACHE_SLOTS) & 0xff)
+#error "LCD_GLYPH_CACHE_SLOTS must include at least one slot"
+#endif
+#endif
+
+#ifdef LCD_FINE_BAR
+// Glyphs for 1..4 filled columns. ROM A02 has no full block, so it needs one
+// for 5 columns, too. 
+#ifdef LCD_ROM_A02
+#define FINE_BAR_GLYPHS 5
+#define FINE_BAR_FULL ((LCD_FINE_BAR_CC) + 4)
+#else
+#define FINE_BAR_GLYPHS 4
+#define FINE_BAR_FULL 0xff
+#endif
+#define FINE_BAR_SLOTS (((1 << FINE_BAR_GLYPHS) - 1) << (LCD_FINE_BAR_CC))
+#if (LCD_FINE_BAR_CC) + FINE_BAR_GLYPHS > 8
+#error "LCD_FINE_BAR_CC is too high, the bar glyphs don't fit into CGRAM"
+#endif
+#if (defined LCD_CC_TILDE) && (FINE_BAR_SLOTS & (1 << (LCD_CC_TILDE)))
+#error "The bar glyphs (LCD_FINE_BAR_CC) overlap LCD_CC_TILDE"
+#endif
+#if (defined LCD_CC_BACKSLASH) && (FINE_BAR_SLOTS & (1 << (LCD_CC_BACKSLASH)))
+#error "The bar glyphs (LCD_FINE_BAR_CC) overlap LCD_CC_BACKSLASH"
+#endif
+#if (defined LCD_CC_IXI) && (FINE_BAR_SLOTS & (1 << (LCD_CC_IXI)))
+#error "The bar glyphs (LCD_FINE_BAR_CC) overlap LCD_CC_IXI"
+#endif
+#if (defined LCD_GLYPH_CACHE) && (FINE_BAR_SLOTS & (LCD_GLYPH_CACHE_SLOTS))
+#error "The bar glyphs (LCD_FINE_BAR_CC) overlap LCD_GLYPH_CACHE_SLOTS"
+#endif
+#endif
+
+#ifdef LCD_CHART
+#if (LCD_CHART_CELLS) < 1 || (LCD_CHART_CC) + (LCD_CHART_CELLS) > 8
+#error "The chart glyphs (LCD_CHART_CC, LCD_CHART_CELLS) don't fit into CGRAM"
+#endif
+#define CHART_SLOTS (((1 << (LCD_CHART_CELLS)) - 1) << (LCD_CHART_CC))
+#if (defined LCD_CC_TILDE) && (CHART_SLOTS & (1 << (LCD_CC_TILDE)))
+#error "The chart glyphs overlap LCD_CC_TILDE"
+#endif
+#if (defined LCD_CC_BACKSLASH) && (CHART_SLOTS & (1 << (LCD_CC_BACKSLASH)))
+#error "The chart glyphs overlap LCD_CC_BACKSLASH"
+#endif
+#if (defined LCD_CC_IXI) && (CHART_SLOTS & (1 << (LCD_CC_IXI)))
+#error "The chart glyphs overlap LCD_CC_IXI"
+#endif
+#if (defined LCD_GLYPH_CACHE) && (CHART_SLOTS & (LCD_GLYPH_CACHE_SLOTS))
+#error "The chart glyphs overlap LCD_GLYPH_CACHE_SLOTS"
+#endif
+#if (defined LCD_FINE_BAR) && (CHART_SLOTS & FINE_BAR_SLOTS)
+#error "The chart glyphs overlap the bar glyphs (LCD_FINE_BAR_CC)"
+#endif
+#endif
+
+#ifdef LCD_BIG_DIGITS
+// Segments: upper bar, lower bar, both. ROM A02 has no full block, so it needs
+// a glyph for that, too. 
+#ifdef LCD_ROM_A02
+#define BIG_GLYPHS 4
+#define BIG_FULL ((LCD_BIG_DIGITS_CC) + 3)
+#else
+#define BIG_GLYPHS 3
+#define BIG_FULL 0xff
+#endif
+#define BIG_SLOTS (((1 << BIG_GLYPHS) - 1) << (LCD_BIG_DIGITS_CC))
+#if (LCD_BIG_DIGITS_CC) + BIG_GLYPHS > 8
+#error "LCD_BIG_DIGITS_CC is too high, the segment glyphs don't fit into CGRAM"
+#endif
+#if (defined LCD_CC_TILDE) && (BIG_SLOTS & (1 << (LCD_CC_TILDE)))
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap LCD_CC_TILDE"
+#endif
+#if (defined LCD_CC_BACKSLASH) && (BIG_SLOTS & (1 << (LCD_CC_BACKSLASH)))
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap LCD_CC_BACKSLASH"
+#endif
+#if (defined LCD_CC_IXI) && (BIG_SLOTS & (1 << (LCD_CC_IXI)))
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap LCD_CC_IXI"
+#endif
+#if (defined LCD_GLYPH_CACHE) && (BIG_SLOTS & (LCD_GLYPH_CACHE_SLOTS))
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap LCD_GLYPH_CACHE_SLOTS"
+#endif
+#if (defined LCD_FINE_BAR) && (BIG_SLOTS & FINE_BAR_SLOTS)
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap the bar glyphs (LCD_FINE_BAR_CC)"
+#endif
+#if (defined LCD_CHART) && (BIG_SLOTS & CHART_SLOTS)
+#error "The segment glyphs (LCD_BIG_DIGITS_CC) overlap the chart glyphs"
+#endif
+#endif
+
+#if (defined LCD_FIELDS) && ((LCD_FIELDS) < 1 || (LCD_FIELDS) > 8)
+#error "LCD_FIELDS must be between 1 and 8"
+#endif
+
+#ifdef LCD_ASYNC
+#if (LCD_ASYNC_QUEUE_SIZE) & ((LCD_ASYNC_QUEUE_SIZE) - 1) || (LCD_ASYNC_QUEUE_SIZE) > 128
+#error "LCD_ASYNC_QUEUE_SIZE must be a power of two and at most 128"
+#endif
+// Timer0 runs with prescaler 8 in CTC mode
+#define ASYNC_TIMER_TOP ((F_CPU) / 8 * (LCD_ASYNC_TICK_US) / 1000000 - 1)
+#if ASYNC_TIMER_TOP > 255 || ASYNC_TIMER_TOP < 1
+#error "LCD_ASYNC_TICK_US cannot be generated by Timer0 at this F_CPU"
+#endif
+/**
+ * \brief Number of additional timer ticks to wait after sending a byte whose
+ * execution takes the given number of microseconds
+ */
+#define ASYNC_TICKS(delay) (((delay) + (LCD_ASYNC_TICK_US) - 1) / (LCD_ASYNC_TICK_US) - 1)
+
+// The queue has 7 bits for the ticks, the longest delay is "Clear display"
+#if ASYNC_TICKS(1640) > 127
+#error "LCD_ASYNC_TICK_US too small for the queue's 7-bit delay field"
+#endif
+#endif
+
+// In asynchronous mode, the timer takes care of the execution times
+#if (defined LCD_BUSY_TIMEOUT) && !(defined LCD_ASYNC)
+#define BUSY_POLLING
+#endif
+
+/*
+ * Bus timing in nanoseconds (minimums from the HD44780 datasheet at 5V, the
+ * address setup time from the KS0066, which is slower). Each of them is
+ * extended by LCD_BUS_MARGIN_NS. 
+ */
+#ifndef LCD_BUS_MARGIN_NS
+#define LCD_BUS_MARGIN_NS 0
+#endif
+// Address setup time: RS and R/W stable before EN goes high
+#define T_SETUP_NS 60
+// Enable pulse width, includes the data setup time for writes (80ns) and the
+// data delay time for reads (160ns)
+#define T_PULSE_NS 230
+// Rest of the enable cycle time (500ns) while EN is low, includes the hold
+// time (10ns)
+#define T_LOW_NS (500 - (T_PULSE_NS))
+
+/**
+ * \brief Number of CPU cycles that take at least the given number of
+ * nanoseconds plus LCD_BUS_MARGIN_NS
+ */
+#define NS_TO_CYCLES(ns) ((((ns) + (LCD_BUS_MARGIN_NS)) * ((F_CPU) / 1000UL) + 999999UL) / 1000000UL)
+
+/**
+ * \brief Waits for a bus timing parameter, see T_SETUP_NS etc. 
+ * 
+ * This doesn't subtract the cycles of the instructions around it, so it errs
+ * on the safe side. 
+ */
+#define busDelay(ns) __builtin_avr_delay_cycles(NS_TO_CYCLES(ns))
+
+/*
+ * Durations of one transfer on the bus (sendNibble() or sendOctet()) and of
+ * one iteration of the polling loop in waitWhileBusy() in nanoseconds and
+ * microseconds (rounded up): One or two enable cycles, respectively, plus
+ * roughly 20 clock cycles for everything else. With LCD_SHORT_ATOMIC, each of
+ * them is an atomic block of its own, which costs a few cycles more, and
+ * quite a few more with LCD_ATOMIC_TIMER (reading the timer twice and
+ * updating lcd_maxAtomicTicks). Too high is fine here, the calibration then
+ * only errs on the slow side. 
+ */
+#ifdef LCD_8BIT
+#define STROBES_PER_BYTE 1
+#else
+#define STROBES_PER_BYTE 2
+#endif
+#define CYCLES_TO_NS(cycles) (((cycles) * 1000000UL + (F_CPU) / 1000 - 1) / ((F_CPU) / 1000))
+#define ENABLE_CYCLES (NS_TO_CYCLES(T_PULSE_NS) + NS_TO_CYCLES(T_LOW_NS))
+#if (defined LCD_SHORT_ATOMIC) && (defined LCD_ATOMIC_TIMER)
+#define ATOMIC_OVERHEAD_CYCLES 40
+#elif defined LCD_SHORT_ATOMIC
+#define ATOMIC_OVERHEAD_CYCLES 6
+#else
+#define ATOMIC_OVERHEAD_CYCLES 0
+#endif
+#define NIBBLE_PERIOD_NS CYCLES_TO_NS(NS_TO_CYCLES(T_SETUP_NS) + ENABLE_CYCLES + 20 + ATOMIC_OVERHEAD_CYCLES)
+#define POLL_PERIOD_NS CYCLES_TO_NS(STROBES_PER_BYTE * ENABLE_CYCLES + 20 + ATOMIC_OVERHEAD_CYCLES)
+#define NIBBLE_PERIOD_US ((NIBBLE_PERIOD_NS + 999) / 1000)
+#define POLL_PERIOD_US ((POLL_PERIOD_NS + 999) / 1000)
+
+/**
+ * \brief Upper bound for the number of busy flag polls during "Clear display"
+ */
+#define CLEAR_POLLS (2 * 1640000UL / POLL_PERIOD_NS + 1)
+
+/*
+ * Longest time the driver keeps interrupts disabled in one go, in
+ * microseconds (not counting the queue in asynchronous mode, which is emptied
+ * by an ISR where interrupts are disabled anyway). Without LCD_SHORT_ATOMIC,
+ * sending a byte includes polling the busy flag with LCD_BUSY_TIMEOUT, and
+ * the calibration polls while "Clear display" executes. 
+ */
+#if (defined LCD_SHORT_ATOMIC) && ((defined BUSY_POLLING) || (defined LCD_CALIBRATE) || (defined LCD_WARM_START))
+#define ATOMIC_WINDOW_US (POLL_PERIOD_US > NIBBLE_PERIOD_US ? POLL_PERIOD_US : NIBBLE_PERIOD_US)
+#elif defined LCD_SHORT_ATOMIC
+#define ATOMIC_WINDOW_US NIBBLE_PERIOD_US
+#elif defined BUSY_POLLING
+#define ATOMIC_WINDOW_US (STROBES_PER_BYTE * NIBBLE_PERIOD_US + 2 + (LCD_BUSY_TIMEOUT) * POLL_PERIOD_US)
+#elif defined LCD_CALIBRATE
+#define ATOMIC_WINDOW_US (STROBES_PER_BYTE * NIBBLE_PERIOD_US + 2 + (CLEAR_POLLS * POLL_PERIOD_NS + 999) / 1000)
+#else
+#define ATOMIC_WINDOW_US (STROBES_PER_BYTE * NIBBLE_PERIOD_US)
+#endif
+
+#if (defined LCD_MAX_ATOMIC_US) && ATOMIC_WINDOW_US > (LCD_MAX_ATOMIC_US)
+#error "The LCD driver may disable interrupts for longer than LCD_MAX_ATOMIC_US"
+#endif
+
+//=============================================================================
+// Internal functions and variables
+
+#ifdef LCD_ATOMIC_TIMER
+uint16_t lcd_maxAtomicTicks = 0;
+
+/**
+ * \brief Value of LCD_ATOMIC_TIMER when interrupts were disabled
+ */
+static uint16_t atomicStart;
+#endif
+
+/**
+ * \brief Disables interrupts, used by LCD_ATOMIC_BLOCK
+ * \return The previous value of SREG
+ */
+static inline uint8_t atomicBegin(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+#ifdef LCD_ATOMIC_TIMER
+	// Only measure if we actually disabled interrupts
+	if(sreg & (1 << SREG_I))
+		atomicStart = LCD_ATOMIC_TIMER;
+#endif
+	return sreg;
+}
+
+/**
+ * \brief Restores SREG at the end of an LCD_ATOMIC_BLOCK
+ * \param sreg Pointer to the value returned by atomicBegin()
+ */
+static inline void atomicEnd(const uint8_t* sreg)
+{
+#ifdef LCD_ATOMIC_TIMER
+	if(*sreg & (1 << SREG_I))
+	{
+		uint16_t ticks = LCD_ATOMIC_TIMER - atomicStart;
+		if(ticks > lcd_maxAtomicTicks)
+			lcd_maxAtomicTicks = ticks;
+	}
+#endif
+	SREG = *sreg;
+	__asm__ volatile ("" ::: "memory");
+}
+
+/**
+ * \brief Works like ATOMIC_BLOCK(ATOMIC_RESTORESTATE) but also keeps track of
+ * how long interrupts were disabled if LCD_ATOMIC_TIMER is defined
+ */
+#define LCD_ATOMIC_BLOCK \
+	for(uint8_t sreg __attribute__((__cleanup__(atomicEnd))) = atomicBegin(), todo = 1; todo; todo = 0)
+
+/*
+ * Transfers to the LCD are either atomic as a whole (BYTE_ATOMIC_BLOCK) or
+ * only while EN is being strobed (STROBE_ATOMIC_BLOCK). 
+ */
+#ifdef LCD_SHORT_ATOMIC
+#define BYTE_ATOMIC_BLOCK
+#define STROBE_ATOMIC_BLOCK LCD_ATOMIC_BLOCK
+#else
+#define BYTE_ATOMIC_BLOCK LCD_ATOMIC_BLOCK
+#define STROBE_ATOMIC_BLOCK
+#endif
+
+/**
+ * \brief Code point of the UTF-8 character being decoded (so far)
+ */
+static uint16_t utf8CodePoint;
+
+/**
+ * \brief Number of continuation bytes still missing from the UTF-8 character
+ * being decoded
+ * 
+ * Bit 7 is set if the character lies beyond U+FFFF, which the LCD cannot
+ * display anyway, so utf8CodePoint need not hold it. 
+ */
+static uint8_t utf8Pending = 0;
+
+/**
+ * \brief Entry of charmap[]
+ */
+typedef struct
+{
+	uint16_t codePoint;
+	uint8_t lcdCode;
+} charmap_t;
+
+/**
+ * \brief Unicode characters that are not simply at the position of their
+ * code point in the LCD's character ROM, see LCD_CHARMAP
+ */
+#define CHARMAP_ENTRY(codePoint, lcdCode) {codePoint, lcdCode},
+static const charmap_t charmap[] PROGMEM = {
+	LCD_CHARMAP(CHARMAP_ENTRY)
+	{0xffff, 0} // Never matches, keeps the table from being empty
+};
+
+/**
+ * \brief Maps a Unicode code point to a character of the LCD
+ * \param codePoint Code point of the character
+ * \return The character code as understood by the LCD
+ */
+static uint8_t mapCodePoint(uint16_t codePoint)
+{
+	// Binary search in charmap[] (excluding the terminating entry)
+	uint8_t low = 0;
+	uint8_t high = sizeof(charmap) / sizeof(charmap[0]) - 1;
+	while(low < high)
+	{
+		uint8_t middle = (low + high) / 2;
+		uint16_t entry = pgm_read_word(&charmap[middle].codePoint);
+		if(entry < codePoint)
+			low = middle + 1;
+		else if(entry > codePoint)
+			high = middle;
+		else
+			return pgm_read_byte(&charmap[middle].lcdCode);
+	}
+	if(codePoint <= LCD_CHARMAP_IDENTITY_MAX)
+		return (uint8_t)codePoint;
+	return LCD_CHARMAP_UNKNOWN;
+}
+
+/*
+ * The data lines DB[7:4] can be assigned to arbitrary pins. In the common case
+ * where they all belong to the same port, they can be accessed with a single
+ * read-modify-write operation instead of one per pin. The comparisons below
+ * are evaluated by the compiler, so only the applicable code path remains. 
+ */
+#define DB_SAME_PORT \
+	(&DB4_REG_PORT == &DB5_REG_PORT && &DB4_REG_PORT == &DB6_REG_PORT && &DB4_REG_PORT == &DB7_REG_PORT && \
+	 &DB4_REG_DDR == &DB5_REG_DDR && &DB4_REG_DDR == &DB6_REG_DDR && &DB4_REG_DDR == &DB7_REG_DDR)
+
+// DB[7:4] are on consecutive pins in the right order, e.g. DB4..7 on P?0..3
+#define DB_CONTIGUOUS (DB5_PIN == DB4_PIN + 1 && DB6_PIN == DB4_PIN + 2 && DB7_PIN == DB4_PIN + 3)
+
+// Port bits occupied by DB[7:4] (only meaningful if DB_SAME_PORT)
+#define DB_MASK ((1 << DB4_PIN) | (1 << DB5_PIN) | (1 << DB6_PIN) | (1 << DB7_PIN))
+
+// Port bits to be set in order to put nibble n on DB[7:4] (ditto)
+#define DB_BITS(n) ((((n) >> 0) & 1) << DB4_PIN | (((n) >> 1) & 1) << DB5_PIN | \
+                    (((n) >> 2) & 1) << DB6_PIN | (((n) >> 3) & 1) << DB7_PIN)
+
+/**
+ * \brief Lookup table for DB_BITS() in case the pins are on the same port but
+ * not in order
+ */
+static const uint8_t dbBits[16] PROGMEM = {
+	DB_BITS(0x0), DB_BITS(0x1), DB_BITS(0x2), DB_BITS(0x3),
+	DB_BITS(0x4), DB_BITS(0x5), DB_BITS(0x6), DB_BITS(0x7),
+	DB_BITS(0x8), DB_BITS(0x9), DB_BITS(0xa), DB_BITS(0xb),
+	DB_BITS(0xc), DB_BITS(0xd), DB_BITS(0xe), DB_BITS(0xf)
+};
+
+#ifdef LCD_8BIT
+/*
+ * The same for DB[3:0] in 8-bit mode
+ */
+#define DB_LO_SAME_PORT \
+	(&DB0_REG_PORT == &DB1_REG_PORT && &DB0_REG_PORT == &DB2_REG_PORT && &DB0_REG_PORT == &DB3_REG_PORT && \
+	 &DB0_REG_DDR == &DB1_REG_DDR && &DB0_REG_DDR == &DB2_REG_DDR && &DB0_REG_DDR == &DB3_REG_DDR)
+#define DB_LO_CONTIGUOUS (DB1_PIN == DB0_PIN + 1 && DB2_PIN == DB0_PIN + 2 && DB3_PIN == DB0_PIN + 3)
+#define DB_LO_MASK ((1 << DB0_PIN) | (1 << DB1_PIN) | (1 << DB2_PIN) | (1 << DB3_PIN))
+#define DB_LO_BITS(n) ((((n) >> 0) & 1) << DB0_PIN | (((n) >> 1) & 1) << DB1_PIN | \
+                       (((n) >> 2) & 1) << DB2_PIN | (((n) >> 3) & 1) << DB3_PIN)
+
+static const uint8_t dbLoBits[16] PROGMEM = {
+	DB_LO_BITS(0x0), DB_LO_BITS(0x1), DB_LO_BITS(0x2), DB_LO_BITS(0x3),
+	DB_LO_BITS(0x4), DB_LO_BITS(0x5), DB_LO_BITS(0x6), DB_LO_BITS(0x7),
+	DB_LO_BITS(0x8), DB_LO_BITS(0x9), DB_LO_BITS(0xa), DB_LO_BITS(0xb),
+	DB_LO_BITS(0xc), DB_LO_BITS(0xd), DB_LO_BITS(0xe), DB_LO_BITS(0xf)
+};
+
+// DB[7:0] occupy an entire port in the right order, e.g. DB0..7 on P?0..7
+#define DB_WHOLE_PORT (DB_SAME_PORT && DB_CONTIGUOUS && DB_LO_SAME_PORT && DB_LO_CONTIGUOUS && \
+	&DB0_REG_PORT == &DB4_REG_PORT && &DB0_REG_DDR == &DB4_REG_DDR && DB0_PIN == 0 && DB4_PIN == 4)
+#endif
+
+/**
+ * \brief Puts a nibble on DB[7:4]
+ * \param nibble Contains the nibble in its lower 4 bits
+ */
+static inline void putHighNibble(uint8_t nibble)
+{
+	if(DB_SAME_PORT && DB_CONTIGUOUS)
+		DB4_REG_PORT = (DB4_REG_PORT & ~DB_MASK) | (nibble << DB4_PIN);
+	else if(DB_SAME_PORT)
+		DB4_REG_PORT = (DB4_REG_PORT & ~DB_MASK) | pgm_read_byte(&dbBits[nibble]);
+	else
+	{
+		DB4_REG_PORT = (DB4_REG_PORT & ~(1 << DB4_PIN)) | (((nibble >> 0) & 1) << DB4_PIN);
+		DB5_REG_PORT = (DB5_REG_PORT & ~(1 << DB5_PIN)) | (((nibble >> 1) & 1) << DB5_PIN);
+		DB6_REG_PORT = (DB6_REG_PORT & ~(1 << DB6_PIN)) | (((nibble >> 2) & 1) << DB6_PIN);
+		DB7_REG_PORT = (DB7_REG_PORT & ~(1 << DB7_PIN)) | (((nibble >> 3) & 1) << DB7_PIN);
+	}
+}
+
+#ifdef LCD_8BIT
+/**
+ * \brief Puts a nibble on DB[3:0]
+ * \param nibble Contains the nibble in its lower 4 bits
+ */
+static inline void putLowNibble(uint8_t nibble)
+{
+	if(DB_LO_SAME_PORT && DB_LO_CONTIGUOUS)
+		DB0_REG_PORT = (DB0_REG_PORT & ~DB_LO_MASK) | (nibble << DB0_PIN);
+	else if(DB_LO_SAME_PORT)
+		DB0_REG_PORT = (DB0_REG_PORT & ~DB_LO_MASK) | pgm_read_byte(&dbLoBits[nibble]);
+	else
+	{
+		DB0_REG_PORT = (DB0_REG_PORT & ~(1 << DB0_PIN)) | (((nibble >> 0) & 1) << DB0_PIN);
+		DB1_REG_PORT = (DB1_REG_PORT & ~(1 << DB1_PIN)) | (((nibble >> 1) & 1) << DB1_PIN);
+		DB2_REG_PORT = (DB2_REG_PORT & ~(1 << DB2_PIN)) | (((nibble >> 2) & 1) << DB2_PIN);
+		DB3_REG_PORT = (DB3_REG_PORT & ~(1 << DB3_PIN)) | (((nibble >> 3) & 1) << DB3_PIN);
+	}
+}
+#endif
+
+/**
+ * \brief Pulses EN so the LCD reads what is on the data lines
+ */
+static inline void strobe(void)
+{
+	// Address setup time
+	busDelay(T_SETUP_NS);
+	// Drive EN high
+	EN_REG_PORT |= (1 << EN_PIN);
+	// Enable pulse width
+	busDelay(T_PULSE_NS);
+	// Pull EN low
+	EN_REG_PORT &= ~(1 << EN_PIN);
+	// Hold time and the rest of the enable cycle time
+	busDelay(T_LOW_NS);
+}
+
+/**
+ * \brief Current level of RS (0 or 1), 0xff if unknown
+ * 
+ * Runs of data bytes (or commands) only need to set RS once. 
+ */
+static uint8_t rsLevel = 0xff;
+
+/**
+ * \brief Sends a nibble (half byte) to the LCD
+ * 
+ * In 8-bit mode, DB[3:0] are left as they are. 
+ * \param regSel Selects the instruction register (0) or the data register (1).
+ * \param nibble Contains the nibble to be sent in its lower 4 bits
+ */
+static void sendNibble(uint8_t regSel, uint8_t nibble)
+{
+	STROBE_ATOMIC_BLOCK
+	{
+		// Register select, unless it is still where the last transfer left it
+		if(regSel != rsLevel)
+		{
+			RS_REG_PORT = (RS_REG_PORT & ~(1 << RS_PIN)) | (regSel << RS_PIN);
+			rsLevel = regSel;
+		}
+		// Put n[3:0] on DB[7:4]
+		putHighNibble(nibble);
+		strobe();
+	}
+}
+
+#ifdef LCD_8BIT
+/**
+ * \brief Sends a whole byte to the LCD in one go when it is in 8-bit mode
+ * \param regSel Selects the instruction register (0) or the data register (1).
+ * \param c The byte to be sent
+ */
+static void sendOctet(uint8_t regSel, uint8_t c)
+{
+	STROBE_ATOMIC_BLOCK
+	{
+		// Register select, unless it is still where the last transfer left it
+		if(regSel != rsLevel)
+		{
+			RS_REG_PORT = (RS_REG_PORT & ~(1 << RS_PIN)) | (regSel << RS_PIN);
+			rsLevel = regSel;
+		}
+		// Put c[7:0] on DB[7:0]
+		if(DB_WHOLE_PORT)
+			DB0_REG_PORT = c;
+		else
+		{
+			putHighNibble(c >> 4);
+			putLowNibble(c & 0x0f);
+		}
+		strobe();
+	}
+}
+#endif
+
+/**
+ * \brief Configures the data pins as inputs with pull-ups
+ */
+static inline void dataPinsInput(void)
+{
+	if(DB_SAME_PORT)
+	{
+		DB4_REG_PORT |= DB_MASK;
+		DB4_REG_DDR &= ~DB_MASK;
+	}
+	else
+	{
+		DB4_REG_PORT |= (1 << DB4_PIN);
+		DB4_REG_DDR &= ~(1 << DB4_PIN);
+		DB5_REG_PORT |= (1 << DB5_PIN);
+		DB5_REG_DDR &= ~(1 << DB5_PIN);
+		DB6_REG_PORT |= (1 << DB6_PIN);
+		DB6_REG_DDR &= ~(1 << DB6_PIN);
+		DB7_REG_PORT |= (1 << DB7_PIN);
+		DB7_REG_DDR &= ~(1 << DB7_PIN);
+	}
+#ifdef LCD_8BIT
+	// In 8-bit mode, the LCD drives DB[3:0] as well
+	if(DB_LO_SAME_PORT)
+	{
+		DB0_REG_PORT |= DB_LO_MASK;
+		DB0_REG_DDR &= ~DB_LO_MASK;
+	}
+	else
+	{
+		DB0_REG_PORT |= (1 << DB0_PIN);
+		DB0_REG_DDR &= ~(1 << DB0_PIN);
+		DB1_REG_PORT |= (1 << DB1_PIN);
+		DB1_REG_DDR &= ~(1 << DB1_PIN);
+		DB2_REG_PORT |= (1 << DB2_PIN);
+		DB2_REG_DDR &= ~(1 << DB2_PIN);
+		DB3_REG_PORT |= (1 << DB3_PIN);
+		DB3_REG_DDR &= ~(1 << DB3_PIN);
+	}
+#endif
+}
+
+/**
+ * \brief Configures the data pins as outputs
+ */
+static inline void dataPinsOutput(void)
+{
+	if(DB_SAME_PORT)
+		DB4_REG_DDR |= DB_MASK;
+	else
+	{
+		DB4_REG_DDR |= (1 << DB4_PIN);
+		DB5_REG_DDR |= (1 << DB5_PIN);
+		DB6_REG_DDR |= (1 << DB6_PIN);
+		DB7_REG_DDR |= (1 << DB7_PIN);
+	}
+#ifdef LCD_8BIT
+	if(DB_LO_SAME_PORT)
+		DB0_REG_DDR |= DB_LO_MASK;
+	else
+	{
+		DB0_REG_DDR |= (1 << DB0_PIN);
+		DB1_REG_DDR |= (1 << DB1_PIN);
+		DB2_REG_DDR |= (1 << DB2_PIN);
+		DB3_REG_DDR |= (1 << DB3_PIN);
+	}
+#endif
+}
+
+#ifdef TICK
+/**
+ * \brief Non-zero while the LCD must not be disturbed by lcd_tick()
+ * 
+ * This is the case during lcd_init() and while a byte or a sequence of bytes
+ * that belong together (like a CGRAM upload) is being sent. lcd_tick() may be
+ * called from an interrupt handler, so it simply skips its work then. 
+ * Incrementing is not atomic, but an interrupt handler always leaves the
+ * value as it found it. 
+ */
+static volatile uint8_t lcdLock = 1;
+#define LOCK() lcdLock++
+#define UNLOCK() lcdLock--
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/**
+ * \brief Sends a whole byte to the LCD
+ * \param regSel Must be 0 for commands, 1 for data
+ * \param c The byte to be sent (evaluated only once)
+ * \param delay Number of microseconds to delay after sending the byte. 
+ * Ignored if busy flag polling is enabled. In asynchronous mode, the byte is
+ * only queued and the delay is converted into timer ticks. 
+ */
+#if defined LCD_ASYNC
+#define SEND_BYTE(regSel, c, delay) do {LOCK(); uint8_t octet = (c); trackAddress(regSel, octet); enqueue(((regSel) << 7) | ASYNC_TICKS(delay), octet); UNLOCK();} while(0)
+#elif defined LCD_BUSY_TIMEOUT
+#define SEND_BYTE(regSel, c, delay) do {LOCK(); uint8_t octet = (c); trackAddress(regSel, octet); sendByte(regSel, octet); UNLOCK();} while(0)
+#elif defined LCD_CALIBRATE
+#define SEND_BYTE(regSel, c, delay) do {LOCK(); uint8_t octet = (c); trackAddress(regSel, octet); sendByte(regSel, octet); _delay_loop_2(CALIBRATED_DELAY(delay)); UNLOCK();} while(0)
+#else
+#define SEND_BYTE(regSel, c, delay) do {LOCK(); uint8_t octet = (c); trackAddress(regSel, octet); sendByte(regSel, octet); _delay_us(delay); UNLOCK();} while(0)
+#endif
+
+/**
+ * \brief Value of lcdAddress when the LCD's address counter is not known
+ */
+#define ADDRESS_UNKNOWN 0xff
+
+/**
+ * \brief Tracks the LCD's address counter, i.e. the DDRAM address the next
+ * character will be written to. 
+ * 
+ * This is not necessarily the same as lcdCursor, e.g. after writing to the
+ * last position of the first line, the LCD's address counter is at 0x10 which
+ * is off-screen. It is ADDRESS_UNKNOWN after accessing CGRAM or moving the
+ * cursor with a command. In asynchronous mode, this is the address after all
+ * queued bytes have been executed. 
+ */
+static uint8_t lcdAddress = ADDRESS_UNKNOWN;
+
+/**
+ * \brief Updates lcdAddress according to a byte being sent to the LCD
+ * \param regSel Must be 0 for commands, 1 for data
+ * \param c The byte being sent
+ */
+static void trackAddress(uint8_t regSel, uint8_t c)
+{
+	if(regSel)
+	{
+		// Writing data increments the address counter. In 2-line mode, the
+		// first line is 0x00..0x27 and the second line is 0x40..0x67. 
+		if(lcdAddress == 0x27)
+			lcdAddress = 0x40;
+		else if(lcdAddress == 0x67)
+			lcdAddress = 0x00;
+		else if(lcdAddress != ADDRESS_UNKNOWN)
+			lcdAddress++;
+	}
+	else if(c & 0b10000000)
+		// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+		lcdAddress = c & 0x7f;
+	else if((c & 0b11000000) == 0b01000000 || (c & 0b11111000) == 0b00010000)
+		// "Set CGRAM address" command: 0 1 A5 A4 A3 A2 A1 A0 or
+		// "Cursor/display shift" command with S/C=0: 0 0 0 1 0 R/L * *
+		lcdAddress = ADDRESS_UNKNOWN;
+	else if((c & 0b11111100) == 0 && c != 0)
+		// "Clear display" or "Return home" command: 0 0 0 0 0 0 1 *
+		lcdAddress = 0x00;
+}
+
+#if (defined BUSY_POLLING) || (defined LCD_CALIBRATE)
+/**
+ * \brief Polls the LCD's busy flag until it is cleared
+ * 
+ * Only the accesses to the bus are atomic, so without LCD_SHORT_ATOMIC, it
+ * must be called with interrupts disabled (e.g. in a BYTE_ATOMIC_BLOCK). 
+ * \param timeout Maximum number of attempts to read the busy flag
+ * \return Number of attempts it took until the LCD was not busy anymore, or
+ * timeout + 1 if it was still busy after that. 
+ */
+static uint16_t waitWhileBusy(uint16_t timeout)
+{
+	// Pull RS low to read the busy flag
+	RS_REG_PORT &= ~(1 << RS_PIN);
+	rsLevel = 0;
+	// Configure DB[7:4] (or DB[7:0] in 8-bit mode) as inputs with pull-up
+	// It is important to de this now, since some LCD controllers drive the
+	// data lines immediately after R/W goes high. Others wait until they
+	// get a pulse on EN. And still others drive the pins immediately but
+	// the value is only valid after an EN pulse. 
+	STROBE_ATOMIC_BLOCK
+	{
+		dataPinsInput();
+		// Now drive R/W high
+		RW_REG_PORT |= (1 << RW_PIN);
+		// Address setup time
+		busDelay(T_SETUP_NS);
+	}
+
+	uint16_t attempts = 0;
+	while(attempts++ < timeout)
+	{
+		uint8_t busy;
+		STROBE_ATOMIC_BLOCK
+		{
+			// Drive EN high
+			EN_REG_PORT |= (1 << EN_PIN);
+			// Enable pulse width (includes the data delay time)
+			busDelay(T_PULSE_NS);
+			// Read busy flag from DB7
+			busy = (DB7_REG_PIN >> DB7_PIN) & 1;
+			// Pull EN low
+			EN_REG_PORT &= ~(1 << EN_PIN);
+			// Hold time and the rest of the enable cycle time
+			busDelay(T_LOW_NS);
+
+#ifndef LCD_8BIT
+			// The same again for the second nibble, which we ignore entirely. 
+			// This might be unnecessary for some controllers but it can't hurt. 
+			EN_REG_PORT |= (1 << EN_PIN);
+			busDelay(T_PULSE_NS);
+			EN_REG_PORT &= ~(1 << EN_PIN);
+			busDelay(T_LOW_NS);
+#endif
+		}
+
+		// Exit loop if LCD not busy anymore
+		if(!busy)
+			break;
+	}
+
+	STROBE_ATOMIC_BLOCK
+	{
+		// Pull R/W low again
+		RW_REG_PORT &= ~(1 << RW_PIN);
+		// Configure data pins as outputs
+		dataPinsOutput();
+		// Address setup time
+		busDelay(T_SETUP_NS);
+	}
+
+	return attempts;
+}
+#endif
+
+/**
+ * \brief Sends a whole byte to the LCD
+ * \param regSel Must be 0 for commands, 1 for data
+ * \param c The byte to be sent
+ */
+static void sendByte(uint8_t regSel, uint8_t c)
+{
+	BYTE_ATOMIC_BLOCK
+	{
+#ifdef LCD_8BIT
+		// Send all 8 bits at once
+		sendOctet(regSel, c);
+#else
+		// Send upper nibble
+		sendNibble(regSel, c >> 4);
+		// Send lower nibble
+		sendNibble(regSel, c & 0x0f);
+#endif
+
+		// Poll busy flag
+#ifdef BUSY_POLLING
+		waitWhileBusy(LCD_BUSY_TIMEOUT);
+#endif
+	}
+}
+
+#ifdef LCD_WARM_START
+/**
+ * \brief Reads DB[7:4] (and DB[3:0] in 8-bit mode) with one pulse on EN
+ * 
+ * Must be called with R/W high and the data pins configured as inputs. 
+ * \return DB[7:0] (DB[3:0] are 0 in 4-bit mode)
+ */
+static inline uint8_t readPins(void)
+{
+	// Drive EN high
+	EN_REG_PORT |= (1 << EN_PIN);
+	// Enable pulse width (includes the data delay time)
+	busDelay(T_PULSE_NS);
+	uint8_t c = (((DB7_REG_PIN >> DB7_PIN) & 1) << 7)
+	          | (((DB6_REG_PIN >> DB6_PIN) & 1) << 6)
+	          | (((DB5_REG_PIN >> DB5_PIN) & 1) << 5)
+	          | (((DB4_REG_PIN >> DB4_PIN) & 1) << 4);
+#ifdef LCD_8BIT
+	c |= (((DB3_REG_PIN >> DB3_PIN) & 1) << 3)
+	   | (((DB2_REG_PIN >> DB2_PIN) & 1) << 2)
+	   | (((DB1_REG_PIN >> DB1_PIN) & 1) << 1)
+	   | (((DB0_REG_PIN >> DB0_PIN) & 1) << 0);
+#endif
+	// Pull EN low
+	EN_REG_PORT &= ~(1 << EN_PIN);
+	// Hold time and the rest of the enable cycle time
+	busDelay(T_LOW_NS);
+	return c;
+}
+
+/**
+ * \brief Reads the busy flag and the address counter
+ * \return The busy flag in bit 7 and the address counter in bits 6..0
+ */
+static uint8_t readStatus(void)
+{
+	uint8_t status;
+	BYTE_ATOMIC_BLOCK
+	{
+		// See waitWhileBusy() for the order of things
+		RS_REG_PORT &= ~(1 << RS_PIN);
+		rsLevel = 0;
+		STROBE_ATOMIC_BLOCK
+		{
+			dataPinsInput();
+			RW_REG_PORT |= (1 << RW_PIN);
+			busDelay(T_SETUP_NS);
+		}
+		STROBE_ATOMIC_BLOCK
+		{
+			status = readPins();
+#ifndef LCD_8BIT
+			// Lower nibble
+			status |= readPins() >> 4;
+#endif
+		}
+		STROBE_ATOMIC_BLOCK
+		{
+			RW_REG_PORT &= ~(1 << RW_PIN);
+			dataPinsOutput();
+			busDelay(T_SETUP_NS);
+		}
+	}
+	return status;
+}
+
+/**
+ * \brief Checks whether the LCD is powered, idle and in sync with us, i.e. in
+ * the right interface mode and expecting the upper nibble next
+ * 
+ * The address counter is set to two different addresses and read back. If
+ * the LCD is not in sync, the commands end up as something else (e.g. "Set
+ * CGRAM address" in 8-bit mode). This is harmless because the full homing
+ * sequence follows in that case. 
+ * \return Non-zero if the LCD is in sync
+ */
+static uint8_t isSynced(void)
+{
+	// Not connected (the pull-ups read as busy) or still busy with its own
+	// power-on reset
+	if(readStatus() & 0x80)
+		return 0;
+	static const uint8_t probes[] PROGMEM = {0x15, 0x4a};
+	for(uint8_t i = 0; i < sizeof(probes); i++)
+	{
+		uint8_t address = pgm_read_byte(&probes[i]);
+		// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+		sendByte(0, 0b10000000 | address);
+		_delay_us(42);
+		if(readStatus() != address)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * \brief Non-zero if lcd_initStep() has found the LCD still initialised
+ */
+static uint8_t warmStart = 0;
+#endif
+
+#ifdef LCD_CALIBRATE
+/**
+ * \brief Converts microseconds into iterations of _delay_loop_2() (which
+ * takes 4 cycles per iteration)
+ */
+#define US_TO_LOOPS(us) ((uint16_t)(((uint32_t)(us) * ((F_CPU) / 1000) + 3999) / 4000))
+
+lcd_timing_t lcd_timing = {0, 0, 0};
+
+/**
+ * \brief Delays (in iterations of _delay_loop_2()) used after data writes,
+ * commands, and "clear display", respectively. 
+ * 
+ * They start out with the datasheet values and are replaced by the measured
+ * ones in lcd_init(). 
+ */
+static uint16_t delayData = US_TO_LOOPS(46);
+static uint16_t delayCommand = US_TO_LOOPS(42);
+static uint16_t delayClear = US_TO_LOOPS(1640);
+
+/**
+ * \brief Maps the datasheet delay given to SEND_BYTE to the calibrated one
+ */
+#define CALIBRATED_DELAY(delay) ((delay) == 46 ? delayData : (delay) == 42 ? delayCommand : delayClear)
+
+/**
+ * \brief Sends a byte to the LCD and measures how long it takes to execute
+ * \param regSel Must be 0 for commands, 1 for data
+ * \param c The byte to be sent
+ * \param nominal The datasheet execution time in microseconds
+ * \return The execution time in microseconds or 0 if the LCD didn't become
+ * ready within twice the nominal time
+ */
+static uint16_t measure(uint8_t regSel, uint8_t c, uint16_t nominal)
+{
+	uint16_t timeout = 2000UL * nominal / POLL_PERIOD_NS + 1;
+	uint16_t attempts;
+	// Interrupts in between polls would make the LCD look faster than it is,
+	// so without LCD_SHORT_ATOMIC, this counts towards ATOMIC_WINDOW_US
+	BYTE_ATOMIC_BLOCK
+	{
+		sendByte(regSel, c);
+		attempts = waitWhileBusy(timeout);
+	}
+	return attempts > timeout ? 0 : ((uint32_t)attempts * POLL_PERIOD_NS + 999) / 1000;
+}
+
+/**
+ * \brief Computes the delay to be used from a measured execution time
+ * \param measured Result of measure(). If it is 0, the datasheet value is
+ * used. 
+ * \param nominal The datasheet execution time in microseconds
+ * \return Delay in iterations of _delay_loop_2()
+ */
+static uint16_t calibratedLoops(uint16_t measured, uint16_t nominal)
+{
+	if(measured == 0)
+		return US_TO_LOOPS(nominal);
+	// The measurement is only accurate up to one polling period
+	return US_TO_LOOPS(measured + (uint32_t)measured * (LCD_CALIBRATE_MARGIN) / 100 + POLL_PERIOD_US);
+}
+
+/**
+ * \brief Measures the LCD's execution times and sets up the delays
+ * accordingly
+ * 
+ * Leaves DDRAM in an undefined state, so the display should be cleared
+ * afterwards. 
+ */
+static void calibrate(void)
+{
+	// "Clear display": 0 0 0 0 0 0 0 1
+	lcd_timing.clear = measure(0, 0b00000001, 1640);
+	// The shorter ones are measured a few times and the slowest result is
+	// used. A single failed measurement (0) discards all the others. 
+	lcd_timing.command = lcd_timing.data = 0xffff;
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+		uint16_t t = measure(0, 0b10000000 | i, 42);
+		if(t == 0 || lcd_timing.command == 0xffff || (lcd_timing.command != 0 && t > lcd_timing.command))
+			lcd_timing.command = t;
+		// Write a space
+		t = measure(1, ' ', 46);
+		if(t == 0 || lcd_timing.data == 0xffff || (lcd_timing.data != 0 && t > lcd_timing.data))
+			lcd_timing.data = t;
+	}
+	delayData = calibratedLoops(lcd_timing.data, 46);
+	delayCommand = calibratedLoops(lcd_timing.command, 42);
+	delayClear = calibratedLoops(lcd_timing.clear, 1640);
+}
+#endif
+
+#ifdef LCD_ASYNC
+/**
+ * \brief Queue of bytes waiting to be sent to the LCD
+ * 
+ * queueData holds the bytes themselves, queueCtrl holds the register select
+ * bit (bit 7) and the number of additional ticks to wait after sending (bits
+ * 6..0). New bytes are inserted at queueHead and removed at queueTail. 
+ */
+static uint8_t queueData[LCD_ASYNC_QUEUE_SIZE];
+static uint8_t queueCtrl[LCD_ASYNC_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0;
+static volatile uint8_t queueTail = 0;
+
+/**
+ * \brief Remaining ticks until the LCD has executed the last byte
+ */
+static volatile uint8_t queueWait = 0;
+
+/**
+ * \brief Largest number of bytes ever waiting in the queue
+ */
+static uint8_t queueHighWater = 0;
+
+/**
+ * \brief Does one tick's worth of work: Sends the next byte from the queue
+ * unless the LCD is still executing the previous one. 
+ * 
+ * Must be called with interrupts disabled. 
+ */
+static void serviceQueue(void)
+{
+	if(queueWait)
+		queueWait--;
+	else if(queueTail != queueHead)
+	{
+		uint8_t ctrl = queueCtrl[queueTail];
+		sendByte(ctrl >> 7, queueData[queueTail]);
+		queueWait = ctrl & 0x7f;
+		queueTail = (queueTail + 1) & ((LCD_ASYNC_QUEUE_SIZE) - 1);
+	}
+	else
+		// Nothing left to do, stop interrupts until the next byte is queued
+		TIMSK0 &= ~(1 << OCIE0A);
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+	serviceQueue();
+}
+
+/**
+ * \brief Puts a byte into the queue
+ * 
+ * Blocks if the queue is full. 
+ * \param ctrl Register select bit and ticks to wait (see queueCtrl)
+ * \param c The byte to be sent
+ */
+static void enqueue(uint8_t ctrl, uint8_t c)
+{
+	uint8_t queued = 0;
+	while(!queued)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			uint8_t next = (queueHead + 1) & ((LCD_ASYNC_QUEUE_SIZE) - 1);
+			if(next != queueTail)
+			{
+				queueData[queueHead] = c;
+				queueCtrl[queueHead] = ctrl;
+				queueHead = next;
+				uint8_t depth = (queueHead - queueTail) & ((LCD_ASYNC_QUEUE_SIZE) - 1);
+				if(depth > queueHighWater)
+					queueHighWater = depth;
+				// Make sure the ISR is running
+				TIMSK0 |= (1 << OCIE0A);
+				queued = 1;
+			}
+		}
+		// The queue is full. If interrupts are disabled, the ISR cannot make
+		// room for us, so do its work here. 
+		if(!queued && !(SREG & (1 << SREG_I)))
+		{
+			serviceQueue();
+			_delay_us(LCD_ASYNC_TICK_US);
+		}
+	}
+}
+#endif
+
+/**
+ * \brief Tracks the position of the (invisible) cursor, i.e. where the next
+ * character will be displayed. 
+ * 
+ * Values are 0..15 for the first line and 16..31 for the second line. The
+ * value 32 indicates position 0 except that we got there by rolling around. 
+ * This means that the next write must clear the LCD first. 
+ * 
+ * In terms of actual addresses in DDRAM, the first line corresponds to
+ * 0x00..0x0f and the second line to 0x40..0x4f. 
+ */
+uint8_t lcdCursor = 0;
+
+/**
+ * \brief Calculates the DDRAM address of a position on the screen
+ * \param cell Position in the same format as lcdCursor
+ */
+static inline uint8_t cellAddress(uint8_t cell)
+{
+	if(cell < 16)
+		return cell;
+	else if(cell < 32)
+		return 0x40 | (cell & 0x0f);
+	else
+		return 0x00;
+}
+
+/**
+ * \brief Update the LCD's internal cursor after modifying lcdCursor
+ */
+static inline void updateCursor()
+{
+#ifndef LCD_FRAMEBUFFER
+	// Calculate DDRAM address
+	uint8_t address = cellAddress(lcdCursor);
+	// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+	// with A[6:0] being the address in DDRAM
+	// This is unnecessary if the LCD's address counter is already there, e.g.
+	// because the last character was written to the previous position. 
+	if(address != lcdAddress)
+		SEND_BYTE(0, 0b10000000 | address, 42);
+#endif
+	// With the framebuffer, the LCD's address counter is only used by
+	// lcd_flush(), which sets it as needed. 
+}
+
+#ifndef LCD_FRAMEBUFFER
+/**
+ * \brief Sends a character to a position on the screen
+ * 
+ * Moves the LCD's address counter there first unless it is already there. 
+ * \param cell Position in the same format as lcdCursor
+ * \param lcdCode The character as understood by the LCD
+ */
+static void writeCell(uint8_t cell, uint8_t lcdCode)
+{
+	uint8_t address = cellAddress(cell);
+	if(address != lcdAddress)
+		// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+		SEND_BYTE(0, 0b10000000 | address, 42);
+	SEND_BYTE(1, lcdCode, 46);
+}
+#endif
+
+#ifdef SHADOW
+/**
+ * \brief Copy of the display contents
+ * 
+ * Indexed like lcdCursor, i.e. 0..15 for the first line and 16..31 for the
+ * second line. With LCD_FRAMEBUFFER, this is what the display will show after
+ * the next lcd_flush(). 
+ */
+static uint8_t lcdFrame[32];
+
+#ifdef LCD_FRAMEBUFFER
+/**
+ * \brief One bit per cell of lcdFrame (bit i for cell i), set if the cell
+ * has been modified since it was last sent to the LCD
+ * 
+ * With LCD_FRAME_RATE, lcd_tick() sends the dirty cells, possibly from an
+ * interrupt handler, so it must only be modified atomically. 
+ */
+static uint32_t lcdDirty = 0;
+
+#ifdef LCD_GLYPH_CACHE
+/**
+ * \brief One bit per CGRAM slot (bit i for slot i), set if a dirty cell
+ * still shows it on the LCD, i.e. until the next flush
+ */
+static uint8_t flushSlots = 0;
+#endif
+#endif
+
+#ifdef LCD_FRAME_RATE
+/**
+ * \brief Number of calls to lcd_tick() until the next frame is sent
+ */
+static uint8_t frameCountdown = FRAME_TICKS;
+
+/**
+ * \brief Marks a cell as dirty without getting in the way of lcd_tick()
+ */
+#define MARK_DIRTY(cell) ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { lcdDirty |= (uint32_t)1 << (cell); }
+#else
+#define MARK_DIRTY(cell) lcdDirty |= (uint32_t)1 << (cell)
+#endif
+
+/**
+ * \brief Puts a character on the screen unless it is already there
+ * 
+ * With LCD_FRAMEBUFFER, the character only goes into the framebuffer. 
+ * Otherwise it is sent to the LCD right away. 
+ * \param cell Position of the character (0..31, see lcdCursor)
+ * \param lcdCode The character as understood by the LCD
+ */
+static void setCell(uint8_t cell, uint8_t lcdCode)
+{
+	if(lcdFrame[cell] != lcdCode)
+	{
+#if (defined LCD_FRAMEBUFFER) && (defined LCD_GLYPH_CACHE)
+		// The old character stays on the LCD until the next flush unless the
+		// cell was dirty already. Character codes 0..7 and 8..15 both refer
+		// to CGRAM.
+		if(lcdFrame[cell] < 16)
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				if(!(lcdDirty & ((uint32_t)1 << cell)))
+					flushSlots |= 1 << (lcdFrame[cell] & 0x07);
+			}
+#endif
+		lcdFrame[cell] = lcdCode;
+#ifdef LCD_FRAMEBUFFER
+		MARK_DIRTY(cell);
+#else
+		writeCell(cell, lcdCode);
+#endif
+	}
+}
+#endif
+
+#ifdef LCD_CONSOLE
+/**
+ * \brief Lines that have scrolled off the top of the screen (ring buffer)
+ */
+static uint8_t scrollback[LCD_CONSOLE_SCROLLBACK][16];
+
+/**
+ * \brief Index in scrollback where the next line goes
+ */
+static uint8_t scrollbackNext = 0;
+
+/**
+ * \brief Number of lines in scrollback
+ */
+static uint8_t scrollbackCount = 0;
+
+/**
+ * \brief Number of lines the view is scrolled back by lcd_scrollBack()
+ */
+static uint8_t consoleView = 0;
+
+/**
+ * \brief The actual screen contents while the view is scrolled back
+ */
+static uint8_t consoleLive[32];
+
+/**
+ * \brief Returns a line of the scrollback
+ * \param back 1 for the line that scrolled off last, 2 for the one before...
+ */
+static inline const uint8_t* scrollbackLine(uint8_t back)
+{
+	uint8_t i = scrollbackNext + (LCD_CONSOLE_SCROLLBACK) - back;
+	if(i >= LCD_CONSOLE_SCROLLBACK)
+		i -= LCD_CONSOLE_SCROLLBACK;
+	return scrollback[i];
+}
+
+/**
+ * \brief Moves the second line up to the first one and blanks the second
+ * 
+ * Only the cells whose content changes are sent. The first line goes into
+ * the scrollback. 
+ */
+static void scroll(void)
+{
+	uint8_t* line = scrollback[scrollbackNext];
+	for(uint8_t cell = 0; cell < 16; cell++)
+		line[cell] = lcdFrame[cell];
+	if(++scrollbackNext == LCD_CONSOLE_SCROLLBACK)
+		scrollbackNext = 0;
+	if(scrollbackCount < LCD_CONSOLE_SCROLLBACK)
+		scrollbackCount++;
+	for(uint8_t cell = 0; cell < 16; cell++)
+		setCell(cell, lcdFrame[cell + 16]);
+	for(uint8_t cell = 16; cell < 32; cell++)
+		setCell(cell, ' ');
+	lcdCursor = 16;
+}
+
+/**
+ * \brief Shows the console as it was a number of lines ago
+ * 
+ * \param lines 0 for the actual screen contents, at most scrollbackCount
+ */
+static void showConsole(uint8_t lines)
+{
+	if(lines == consoleView)
+		return;
+	if(!consoleView)
+		// Keep the actual screen contents to return to
+		for(uint8_t cell = 0; cell < 32; cell++)
+			consoleLive[cell] = lcdFrame[cell];
+	consoleView = lines;
+	const uint8_t* top;
+	const uint8_t* bottom;
+	if(!lines)
+	{
+		top = consoleLive;
+		bottom = consoleLive + 16;
+	}
+	else
+	{
+		top = scrollbackLine(lines);
+		bottom = lines == 1 ? consoleLive : scrollbackLine(lines - 1);
+	}
+	for(uint8_t cell = 0; cell < 16; cell++)
+		setCell(cell, top[cell]);
+	for(uint8_t cell = 0; cell < 16; cell++)
+		setCell(cell + 16, bottom[cell]);
+}
+#endif
+
+/**
+ * \brief Writes a character at the cursor position and advances the cursor
+ * 
+ * Breaks the line or clears the screen (scrolls with LCD_CONSOLE) if
+ * necessary, see lcd_writeChar(). 
+ * \param lcdCode The character as understood by the LCD
+ */
+static void writeCode(uint8_t lcdCode)
+{
+#ifdef LCD_CONSOLE
+	// Output always goes to the actual screen contents
+	showConsole(0);
+#endif
+	// If current line is full, break automatically
+	if(lcdCursor == 32)
+#ifdef LCD_CONSOLE
+		scroll();
+#else
+		lcd_clear();
+#endif
+	else if(lcdCursor == 16)
+		lcd_line2();
+
+	// Write character
+#ifdef SHADOW
+	setCell(lcdCursor, lcdCode);
+#else
+	// The address counter is usually there already, but lcd_drawFineBar()
+	// leaves it behind the bar
+	writeCell(lcdCursor, lcdCode);
+#endif
+	lcdCursor++;
+}
+
+/**
+ * \brief Writes consecutive glyphs from program memory into CGRAM
+ * 
+ * The LCD increments the CGRAM address after every data write, so one
+ * "Set CGRAM address" command is enough for all of them. 
+ * \param firstSlot CGRAM slot of the first glyph (0..7)
+ * \param glyphs_P Pointer to 8 bytes per glyph in program memory, one per
+ * pixel row
+ * \param count Number of glyphs (firstSlot + count must not exceed 8)
+ */
+static void uploadGlyphs(uint8_t firstSlot, const uint8_t* glyphs_P, uint8_t count)
+{
+	LOCK();
+	// "Set CGRAM address" command: 0 1 A5 A4 A3 A2 A1 A0
+	// with A[5:0]=the byte address in CGRAM (each character takes 8 bytes)
+	SEND_BYTE(0, 0b01000000 | (8 * firstSlot), 42);
+	for(uint8_t i = 8 * count; i > 0; i--)
+		SEND_BYTE(1, pgm_read_byte(glyphs_P++), 46);
+	// Move address pointer back to DDRAM, otherwise all following data writes
+	// would go into CGRAM. 
+	updateCursor();
+	UNLOCK();
+}
+
+/**
+ * \brief Splits a CUSTOM_CHAR() bitmap into its 8 rows, for use in
+ * initialisers of glyph tables
+ */
+#define GLYPH_ROWS(chr) \
+	(uint8_t)((chr) >> 0 * 8), (uint8_t)((chr) >> 1 * 8), \
+	(uint8_t)((chr) >> 2 * 8), (uint8_t)((chr) >> 3 * 8), \
+	(uint8_t)((chr) >> 4 * 8), (uint8_t)((chr) >> 5 * 8), \
+	(uint8_t)((chr) >> 6 * 8), (uint8_t)((chr) >> 7 * 8)
+
+/**
+ * \brief Writes a string that consists only of characters that are the same
+ * in ASCII and in the LCD's character set (like digits), skipping the
+ * UTF-8 decoder
+ * \param text The string to be written
+ */
+static void writeAscii(const char* text)
+{
+	while(*text)
+		writeCode(*text++);
+}
+
+/**
+ * \brief Moves the cursor to the start of the next line
+ * 
+ * From line 2, the cursor rolls over, i.e. the next character clears the
+ * screen (or scrolls it up with LCD_CONSOLE). With LCD_CONSOLE, a line break
+ * after one that rolled over scrolls right away. 
+ */
+static void newLine(void)
+{
+	// When in line 1, go to line 2
+	if(lcdCursor < 16)
+		lcdCursor = 16;
+	// When in line 2, roll over
+	else
+	{
+#ifdef LCD_CONSOLE
+		// Carry out a roll over that is still pending, so that every line
+		// break scrolls by one line
+		if(lcdCursor == 32)
+		{
+			showConsole(0);
+			scroll();
+		}
+#endif
+		lcdCursor = 32;
+	}
+	updateCursor();
+}
+
+#ifdef LCD_GLYPH_CACHE
+/**
+ * \brief Value of slotGlyph[] for slots whose content is unknown
+ */
+#define NO_GLYPH 0xff
+
+/**
+ * \brief Table of glyphs set by lcd_setGlyphTable()
+ */
+static const uint8_t* glyphTable = 0;
+
+/**
+ * \brief ID of the glyph in each CGRAM slot (or NO_GLYPH)
+ */
+static uint8_t slotGlyph[8] = {NO_GLYPH, NO_GLYPH, NO_GLYPH, NO_GLYPH, NO_GLYPH, NO_GLYPH, NO_GLYPH, NO_GLYPH};
+
+/**
+ * \brief Value of glyphUses when each slot was last used
+ */
+static uint16_t slotUsed[8];
+
+/**
+ * \brief Counts calls to glyphSlot(), used for least recently used eviction
+ */
+static uint16_t glyphUses = 0;
+
+/**
+ * \brief Determines which CGRAM slots are currently on the screen
+ * \return Bit i is set if slot i is visible
+ */
+static uint8_t visibleSlots(void)
+{
+#ifdef LCD_FRAMEBUFFER
+	// lcdFrame is the next frame, some of the current one may still be on
+	// the LCD
+	uint8_t visible = flushSlots;
+#else
+	uint8_t visible = 0;
+#endif
+	for(uint8_t cell = 0; cell < 32; cell++)
+		// Character codes 0..7 and 8..15 both refer to CGRAM
+		if(lcdFrame[cell] < 16)
+			visible |= 1 << (lcdFrame[cell] & 0x07);
+	return visible;
+}
+
+/**
+ * \brief Finds the CGRAM slot holding a glyph, uploading it if necessary
+ * \param id Index of the glyph in glyphTable
+ * \return The slot, i.e. the character code to be written to show the glyph,
+ * or LCD_CHARMAP_UNKNOWN if all slots are visible
+ */
+static uint8_t glyphSlot(uint8_t id)
+{
+	glyphUses++;
+	// Is the glyph already loaded?
+	for(uint8_t slot = 0; slot < 8; slot++)
+	{
+		if(((LCD_GLYPH_CACHE_SLOTS) & (1 << slot)) && slotGlyph[slot] == id)
+		{
+			slotUsed[slot] = glyphUses;
+			return slot;
+		}
+	}
+	// Evict the least recently used slot among those that are not visible
+	// (which includes empty ones). A visible one must not change, that would
+	// change the characters on the screen, too. 
+	uint8_t visible = visibleSlots();
+	uint8_t victim = 0xff;
+	uint16_t victimAge = 0;
+	for(uint8_t slot = 0; slot < 8; slot++)
+	{
+		if(!((LCD_GLYPH_CACHE_SLOTS) & (1 << slot)) || (visible & (1 << slot)))
+			continue;
+		uint16_t age = glyphUses - slotUsed[slot];
+		if(slotGlyph[slot] == NO_GLYPH)
+			age = 0xffff;
+		if(victim == 0xff || age > victimAge)
+		{
+			victim = slot;
+			victimAge = age;
+		}
+	}
+	if(victim == 0xff)
+		// All of them are on the screen
+		return LCD_CHARMAP_UNKNOWN;
+	uploadGlyphs(victim, glyphTable + 8 * id, 1);
+	slotGlyph[victim] = id;
+	slotUsed[victim] = glyphUses;
+	return victim;
+}
+#endif
+
+#ifdef LCD_ANIMATION
+/**
+ * \brief State of an animation started by lcd_animate()
+ */
+typedef struct
+{
+	const uint8_t* frames;	// Frames in program memory (0 if unused)
+	uint8_t slot;			// CGRAM slot
+	uint8_t count;			// Number of frames
+	uint8_t frame;			// Frame currently in CGRAM
+	uint8_t period;			// Ticks per frame
+	uint8_t countdown;		// Ticks until the next frame
+} animation_t;
+
+static animation_t animations[LCD_ANIMATIONS];
+
+/**
+ * \brief Changes a glyph in CGRAM, sending only the rows that differ
+ * 
+ * Consecutive changed rows share one "Set CGRAM address" command. 
+ * Does not move the address counter back to DDRAM. 
+ * \param slot CGRAM slot (0..7)
+ * \param from_P The glyph currently in the slot (8 bytes in program memory)
+ * \param to_P The new glyph (8 bytes in program memory)
+ */
+static void uploadRows(uint8_t slot, const uint8_t* from_P, const uint8_t* to_P)
+{
+	// Row the LCD's CGRAM address counter points to (8 if not in this slot)
+	uint8_t next = 8;
+	for(uint8_t row = 0; row < 8; row++)
+	{
+		uint8_t bits = pgm_read_byte(to_P + row);
+		if(bits == pgm_read_byte(from_P + row))
+			continue;
+		if(row != next)
+			// "Set CGRAM address" command: 0 1 A5 A4 A3 A2 A1 A0
+			SEND_BYTE(0, 0b01000000 | (8 * slot + row), 42);
+		SEND_BYTE(1, bits, 46);
+		next = row + 1;
+	}
+}
+
+/**
+ * \brief Advances all animations by one tick
+ * \return Non-zero if anything was sent to CGRAM
+ */
+static uint8_t animate(void)
+{
+	uint8_t changed = 0;
+	for(animation_t* a = animations; a < animations + LCD_ANIMATIONS; a++)
+	{
+		if(!a->frames || --a->countdown)
+			continue;
+		a->countdown = a->period;
+		uint8_t next = a->frame + 1;
+		if(next == a->count)
+			next = 0;
+		uploadRows(a->slot, a->frames + 8 * a->frame, a->frames + 8 * next);
+		a->frame = next;
+		changed = 1;
+	}
+	return changed;
+}
+#endif
+
+#ifdef LCD_FINE_BAR
+// All eight pixel rows of a bar glyph are the same
+#define FINE_BAR_ROWS(bits) bits, bits, bits, bits, bits, bits, bits, bits
+
+/**
+ * \brief Glyphs of partially filled cells, uploaded to LCD_FINE_BAR_CC and up
+ */
+static const uint8_t fineBarGlyphs[] PROGMEM = {
+	FINE_BAR_ROWS(0b10000),
+	FINE_BAR_ROWS(0b11000),
+	FINE_BAR_ROWS(0b11100),
+	FINE_BAR_ROWS(0b11110),
+#ifdef LCD_ROM_A02
+	FINE_BAR_ROWS(0b11111),
+#endif
+};
+
+/**
+ * \brief Level of the bar in each line as currently on the screen
+ * 
+ * 0 also stands for an empty line, e.g. after lcd_clear() or lcd_erase(). 
+ */
+static uint8_t fineBarLevel[2];
+#endif
+
+#ifdef LCD_BIG_DIGITS
+/**
+ * \brief Segment glyphs, uploaded to LCD_BIG_DIGITS_CC and up
+ */
+static const uint8_t bigGlyphs[] PROGMEM = {
+	0b11111, 0b11111, 0, 0, 0, 0, 0, 0,					// Upper bar
+	0, 0, 0, 0, 0, 0, 0b11111, 0b11111,					// Lower bar
+	0b11111, 0b11111, 0, 0, 0, 0, 0b11111, 0b11111,		// Both
+#ifdef LCD_ROM_A02
+	0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111,
+#endif
+};
+
+// Cells of the big digits
+#define BIG_U (LCD_BIG_DIGITS_CC)
+#define BIG_L ((LCD_BIG_DIGITS_CC) + 1)
+#define BIG_B ((LCD_BIG_DIGITS_CC) + 2)
+#define BIG_F BIG_FULL
+#define BIG__ ' '
+
+/**
+ * \brief Shapes of the big digits 0..9 and of a blank (10)
+ * 
+ * Three cells of the first line followed by three cells of the second line.
+ */
+static const uint8_t bigShapes[11][6] PROGMEM = {
+	{BIG_F, BIG_U, BIG_F, BIG_F, BIG_L, BIG_F},
+	{BIG_U, BIG_F, BIG__, BIG_L, BIG_F, BIG_L},
+	{BIG_B, BIG_B, BIG_F, BIG_F, BIG_L, BIG_L},
+	{BIG_B, BIG_B, BIG_F, BIG_L, BIG_L, BIG_F},
+	{BIG_F, BIG_L, BIG_F, BIG__, BIG__, BIG_F},
+	{BIG_F, BIG_B, BIG_B, BIG_L, BIG_L, BIG_F},
+	{BIG_F, BIG_B, BIG_B, BIG_F, BIG_L, BIG_F},
+	{BIG_U, BIG_U, BIG_F, BIG__, BIG__, BIG_F},
+	{BIG_F, BIG_B, BIG_F, BIG_F, BIG_L, BIG_F},
+	{BIG_F, BIG_B, BIG_F, BIG_L, BIG_L, BIG_F},
+	{BIG__, BIG__, BIG__, BIG__, BIG__, BIG__}
+};
+
+/**
+ * \brief Column of the number drawn by lcd_writeBigDec() (0xff if unknown)
+ */
+static uint8_t bigColumn = 0xff;
+
+/**
+ * \brief Digits of the number drawn by lcd_writeBigDec() (10 for blank),
+ * the least significant one first
+ */
+static uint8_t bigDigits[4];
+#endif
+
+#ifdef LCD_FIELDS
+/**
+ * \brief Descriptors of the fields, set by lcd_setFields()
+ */
+static const lcd_field_t* fields = 0;
+
+/**
+ * \brief Number of fields in fields
+ */
+static uint8_t fieldCount = 0;
+
+/**
+ * \brief Values of the fields as set by lcd_setField()
+ */
+static volatile int32_t fieldValues[LCD_FIELDS];
+
+/**
+ * \brief One bit per field (bit i for field i), set if it needs to be drawn
+ */
+static volatile uint8_t fieldDirty = 0;
+
+/**
+ * \brief One bit per field (bit i for field i), set if it doesn't fit into
+ * its line or has too many decimals and is never drawn
+ */
+static uint8_t fieldMisfit = 0;
+#endif
+
+#ifdef LCD_MARQUEE
+/**
+ * \brief State of one line of the marquee started by lcd_marquee()
+ * 
+ * The text loops around, followed by spaces if it is shorter than the 40
+ * columns of DDRAM. DDRAM column c always holds the position p of the loop
+ * with p = c modulo 40 among the 40 positions starting with the leftmost
+ * visible one. 
+ */
+typedef struct
+{
+	const char* text;		// Text in program memory
+	uint8_t textLength;		// Number of characters in text
+	uint8_t length;			// Length of the loop (at least 40)
+	uint8_t next;			// Position of the loop that comes into DDRAM next
+} marquee_t;
+
+static marquee_t marquees[2];
+
+/**
+ * \brief Number of columns the display is currently shifted to the left
+ * (0..39)
+ */
+static uint8_t marqueeShift;
+
+/**
+ * \brief Number of calls to lcd_tick() per step, 0 if there is no marquee
+ */
+static uint8_t marqueePeriod = 0;
+
+/**
+ * \brief Number of calls to lcd_tick() until the next step
+ */
+static uint8_t marqueeCountdown;
+
+/**
+ * \brief Returns the character at a position of a marquee's loop
+ */
+static uint8_t marqueeChar(const marquee_t* m, uint8_t position)
+{
+	return position < m->textLength ? pgm_read_byte(m->text + position) : ' ';
+}
+
+/**
+ * \brief Advances the marquee by one tick
+ * \return Non-zero if the address counter was moved
+ */
+static uint8_t scrollMarquee(void)
+{
+	if(!marqueePeriod || --marqueeCountdown)
+		return 0;
+	marqueeCountdown = marqueePeriod;
+	// "Cursor/display shift" command: 0 0 0 1 S/C R/L * *
+	// with S/C=1 (shift the display), R/L=0 (to the left)
+	SEND_BYTE(0, 0b00011000, 42);
+	// The column that has just left the screen on the left takes the next
+	// position of the loop. Loops of exactly 40 positions are already there. 
+	uint8_t column = marqueeShift;
+	if(++marqueeShift == 40)
+		marqueeShift = 0;
+	uint8_t changed = 0;
+	for(uint8_t line = 0; line < 2; line++)
+	{
+		marquee_t* m = &marquees[line];
+		if(m->length == 40)
+			continue;
+		// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+		SEND_BYTE(0, 0b10000000 | (line << 6) | column, 42);
+		SEND_BYTE(1, marqueeChar(m, m->next), 46);
+		if(++m->next == m->length)
+			m->next = 0;
+		changed = 1;
+	}
+	return changed;
+}
+#endif
+
+#ifdef LCD_CHART
+/**
+ * \brief Copy of the chart glyphs in CGRAM, 8 rows per cell
+ * 
+ * Filled with 0xff by lcd_init(), which never occurs in a glyph, so that
+ * everything is sent the first time. 
+ */
+static uint8_t chartRows[8 * (LCD_CHART_CELLS)];
+#endif
+
+/**
+ * \brief Helper function for stdio
+ */
+static int lcd_putchar(const char c, FILE* stream)
+{
+	lcd_writeChar(c);
+	return 0;
+}
+
+/**
+ * \brief Create a FILE through which stdio can write to the LCD
+ * 
+ * The first call to FDEV_SETUP_STREAM with _FDEV_SETUP_WRITE will
+ * automatically assign the result to stdout and stderr. This might not be
+ * desired. Additionally, if other drivers (e.g. UART) also create FILEs, it is
+ * unclear which one gets to become stdout/stderr. For that reason, we assign
+ * stdout and/or stderr manually in lcd_init(), depending on settings in lcd.h.
+ */
+static FILE lcdOut = FDEV_SETUP_STREAM(lcd_putchar, NULL, _FDEV_SETUP_WRITE);
+
+//=============================================================================
+// Public functions and variables
+
+//-----------------------------------------------------------------------------
+// Initialisation
+
+/**
+ * \brief Forgets everything that was on the display after it has been cleared
+ */
+static void cleared(void)
+{
+#ifdef LCD_MARQUEE
+	marqueePeriod = 0;
+#endif
+#ifdef LCD_FINE_BAR
+	fineBarLevel[0] = fineBarLevel[1] = 0;
+#endif
+#ifdef LCD_BIG_DIGITS
+	bigColumn = 0xff;
+#endif
+#ifdef LCD_CONSOLE
+	consoleView = 0;
+#endif
+#ifdef LCD_FIELDS
+	// The fields are gone from the screen
+	fieldDirty = 0xff;
+#endif
+	lcdCursor = 0;
+}
+
+/**
+ * \brief The next step lcd_initStep() will do (0 means start over)
+ */
+static uint8_t initState = 0;
+
+void lcd_init(void)
+{
+	initState = 0;
+	uint8_t wait;
+	while((wait = lcd_initStep()))
+	{
+		// delayMs() wants a constant
+		while(wait--)
+			delayMs(1);
+	}
+}
+
+uint8_t lcd_initStep(void)
+{
+	switch(initState)
+	{
+	case 0:
+#ifdef TICK
+		// Keep lcd_tick() away until the LCD is ready
+		lcdLock = 1;
+#endif
+#ifdef LCD_ANIMATION
+		for(uint8_t i = 0; i < LCD_ANIMATIONS; i++)
+			animations[i].frames = 0;
+#endif
+		// Configure all pins as output, low
+#if (defined RW_REG_PORT) && (defined RW_REG_DDR) && (defined RW_PIN)
+		RW_REG_PORT &= ~(1 << RW_PIN);
+		RW_REG_DDR |= (1 << RW_PIN);
+#endif
+		RS_REG_PORT &= ~(1 << RS_PIN);
+		RS_REG_DDR |= (1 << RS_PIN);
+		rsLevel = 0;
+		EN_REG_PORT &= ~(1 << EN_PIN);
+		EN_REG_DDR |= (1 << EN_PIN);
+		DB4_REG_PORT &= ~(1 << DB4_PIN);
+		DB4_REG_DDR |= (1 << DB4_PIN);
+		DB5_REG_PORT &= ~(1 << DB5_PIN);
+		DB5_REG_DDR |= (1 << DB5_PIN);
+		DB6_REG_PORT &= ~(1 << DB6_PIN);
+		DB6_REG_DDR |= (1 << DB6_PIN);
+		DB7_REG_PORT &= ~(1 << DB7_PIN);
+		DB7_REG_DDR |= (1 << DB7_PIN);
+#ifdef LCD_8BIT
+		DB0_REG_PORT &= ~(1 << DB0_PIN);
+		DB0_REG_DDR |= (1 << DB0_PIN);
+		DB1_REG_PORT &= ~(1 << DB1_PIN);
+		DB1_REG_DDR |= (1 << DB1_PIN);
+		DB2_REG_PORT &= ~(1 << DB2_PIN);
+		DB2_REG_DDR |= (1 << DB2_PIN);
+		DB3_REG_PORT &= ~(1 << DB3_PIN);
+		DB3_REG_DDR |= (1 << DB3_PIN);
+#endif
+
+		// We have no idea what state the LCD is in
+		lcdAddress = ADDRESS_UNKNOWN;
+
+#ifdef LCD_ASYNC
+		// Set up Timer0 to generate a compare match every LCD_ASYNC_TICK_US and
+		// start with an empty queue
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			TIMSK0 = 0;
+			TCCR0A = (0b00 << COM0A0)	// Disable PWM output on OC0A
+			       | (0b00 << COM0B0)	// Disable PWM output on OC0B
+			       | (0b10 << WGM00);	// CTC mode
+			TCCR0B = (0 << WGM02)
+			       | (0b010 << CS00);	// Prescaler 1:8
+			OCR0A = ASYNC_TIMER_TOP;
+			queueHead = queueTail = queueWait = 0;
+		}
+#endif
+
+#ifdef LCD_WARM_START
+		// After a reset of the uC alone (watchdog, brown-out), the LCD is
+		// usually still powered and in 4-bit mode
+		warmStart = isSynced();
+		if(warmStart)
+		{
+			// Skip the homing sequence
+			initState = 3;
+			return lcd_initStep();
+		}
+#endif
+
+		// Power on delay: The LCD needs up to 15ms to complete its reset
+		initState = 1;
+		return 15;
+	case 1:
+		//-------------------------------------------------------------------------
+		// Start of homing sequence
+		// The goal is to put the LCD reliably into 4-bit mode regardless of its
+		// current state. Keep in mind the LCD does not necessarily reset when the
+		// uC does. 
+		// Since we're not yet synchronised, we can't read the busy bit and have to
+		// do everything via timing. 
+		//
+		// The relevant command is "Function set": 0 0 1 DL N F * * (order DB7:0)
+		// DL=1 turns the interface to 8-bit mode and DL=0 to 4-bit mode. 
+		// N and F control 1/2-line mode and 5x8/5x11 character size, respectively.
+		// N and F don't matter for now, we can set them later once we're synced. 
+		// The *'s are don't cares. 
+		//
+		// There are three states the LCD could potentially be in:
+		// a) 8-bit mode
+		// b) 4-bit mode with the next nibble being the upper half of a byte
+		// c) 4-bit mode with the next nibble being the lower half of a byte. This
+		// might happen if the uC was reset after sending only one of two nibbles.
+		// 
+		// The following comments describe what happens in each of these 3 cases.
+
+		// Send 0b0011 on DB7:4. This causes the following to happen:
+		// a) 0b0011**** is received and executed. The LCD remains in 8-bit mode. 
+		// b) 0b0011 is received and stored as the first half of a command. 
+		// c) 0b0011 is received and together with the last transmission, a command
+		//    0b****0011 is executed. We have no idea what that does. 
+		sendNibble(0, 0b0011);
+		// Wait 4.1ms (enough time for any kind of command to finish)
+		initState = 2;
+		return 5;
+	case 2:
+		// Send 0b0011 on DB7:4. This causes the following to happen:
+		// a) 0b0011**** is received and executed. The LCD remains in 8-bit mode. 
+		// b) 0b0011 is received and together with the last transmission, the
+		//    command 0b00110011 is executed, putting the LCD into 8-bit mode. 
+		// c) 0b0011 is received and stored as the first half of a command. 
+		sendNibble(0, 0b0011);
+		// Wait 100 us (enough time for 0b0011**** command to finish)
+		_delay_us(100);
+
+		// Send 0b0011 on DB7:4. This causes the following to happen:
+		// a) 0b0011**** is received and executed. The LCD remains in 8-bit mode. 
+		// b) 0b0011**** is received and executed. The LCD remains in 8-bit mode. 
+		// c) 0b0011 is received and together with the last transmission, the
+		//    command 0b00110011 is executed, putting the LCD into 8-bit mode. 
+		sendNibble(0, 0b0011);
+		// Wait 100 us (enough time for 0b0011**** command to finish)
+		_delay_us(100);
+
+#ifdef LCD_8BIT
+		// End of homing sequence. The LCD is now in 8-bit mode, which is where we
+		// want it to be (DB3:0 were low all along, so it has received 0b00110000).
+		//-------------------------------------------------------------------------
+
+		// Fall through
+	case 3:
+		// "Function set" command: 0 0 1 DL N F * *
+		// with DL=1 (8 bit mode), N=1 (2 lines), F=0 (5x8 characters)
+		SEND_BYTE(0, 0b00111000, 42);
+#else
+		// Send 0b0010. Since the LCD is now in 8-bit mode, the command 0b0010****
+		// is executed, putting the LCD into 4-bit mode. 
+		sendNibble(0, 0b0010);
+		// Wait 42 us
+		_delay_us(42);
+		// End of homing sequence. The LCD is now in 4-bit mode. 
+		//-------------------------------------------------------------------------
+
+		// Fall through
+	case 3:
+		// "Function set" command: 0 0 1 DL N F * *
+		// with DL=0 (4 bit mode), N=1 (2 lines), F=0 (5x8 characters)
+		SEND_BYTE(0, 0b00101000, 42);
+#endif
+		// "Display on/off" command: 0 0 0 0 1 D B C
+		// with D=0 (Display off), B=0 (no blinking), C=0 (cursor off)
+		SEND_BYTE(0, 0b00001000, 42);
+#ifdef LCD_CALIBRATE
+		// Measure how fast the LCD actually is
+		calibrate();
+#endif
+		// "Clear display" command: 0 0 0 0 0 0 0 1
+#if (defined LCD_ASYNC) || (defined BUSY_POLLING) || (defined LCD_CALIBRATE)
+		// Its execution time is taken care of anyway
+		SEND_BYTE(0, 0b00000001, 1640);
+#else
+		LOCK();
+		trackAddress(0, 0b00000001);
+#ifdef LCD_WARM_START
+		if(warmStart)
+		{
+			// The LCD has answered before, so ask it when it's done. Each
+			// read is atomic on its own, interrupts may come in between. 
+			sendByte(0, 0b00000001);
+			uint16_t polls = CLEAR_POLLS;
+			while(polls-- && (readStatus() & 0x80));
+			UNLOCK();
+		}
+		else
+#endif
+		{
+			sendByte(0, 0b00000001);
+			UNLOCK();
+			// The caller waits for it to finish
+			initState = 4;
+			return 2;
+		}
+#endif
+		// Fall through
+	default:
+		initState = 0;
+#ifdef SHADOW
+		for(uint8_t cell = 0; cell < 32; cell++)
+			lcdFrame[cell] = ' ';
+#endif
+#ifdef LCD_FRAMEBUFFER
+		lcdDirty = 0;
+#ifdef LCD_GLYPH_CACHE
+		flushSlots = 0;
+#endif
+#endif
+		cleared();
+#ifdef LCD_GLYPH_CACHE
+		// CGRAM contents are unknown after a reset
+		for(uint8_t slot = 0; slot < 8; slot++)
+			slotGlyph[slot] = NO_GLYPH;
+#endif
+		// "Entry mode set" command: 0 0 0 0 0 1 I/D S
+		// with I/D=1 (cursor moving right), S=0 (no shifting)
+		SEND_BYTE(0, 0b00000110, 42);
+		// "Display on/off" command: 0 0 0 0 1 D B C
+		// with D=1 (Display on), B=0 (no blinking), C=0 (cursor off)
+		SEND_BYTE(0, 0b00001100, 42);
+		
+	    // Register custom characters
+#ifdef LCD_CC_IXI
+	    lcd_registerCustomChar(LCD_CC_IXI, LCD_CC_IXI_BITMAP);
+#endif
+#if (defined LCD_CC_TILDE) && (defined LCD_CC_BACKSLASH) && (LCD_CC_BACKSLASH == LCD_CC_TILDE + 1)
+		// Adjacent slots (the default), so both go in one burst
+		static const uint8_t defaultGlyphs[] PROGMEM = {
+			GLYPH_ROWS(LCD_CC_TILDE_BITMAP),
+			GLYPH_ROWS(LCD_CC_BACKSLASH_BITMAP)
+		};
+		uploadGlyphs(LCD_CC_TILDE, defaultGlyphs, 2);
+#else
+#ifdef LCD_CC_TILDE
+	    lcd_registerCustomChar(LCD_CC_TILDE, LCD_CC_TILDE_BITMAP);
+#endif
+#ifdef LCD_CC_BACKSLASH
+	    lcd_registerCustomChar(LCD_CC_BACKSLASH, LCD_CC_BACKSLASH_BITMAP);
+#endif
+#endif
+#ifdef LCD_FINE_BAR
+		uploadGlyphs(LCD_FINE_BAR_CC, fineBarGlyphs, FINE_BAR_GLYPHS);
+#endif
+#ifdef LCD_BIG_DIGITS
+		uploadGlyphs(LCD_BIG_DIGITS_CC, bigGlyphs, BIG_GLYPHS);
+#endif
+#ifdef LCD_CHART
+		for(uint8_t i = 0; i < sizeof(chartRows); i++)
+			chartRows[i] = 0xff;
+#endif
+		
+		// Redirect stdout and/or stderr to LCD
+#ifndef LCD_NO_STDOUT_REDIRECT
+		stdout = &lcdOut;
+#endif
+#ifndef LCD_NO_STDERR_REDIRECT
+		stderr = &lcdOut;
+#endif
+#ifdef TICK
+		lcdLock = 0;
+#endif
+		return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Cursor movement
+
+void lcd_line1(void)
+{
+	lcdCursor = 0;
+	updateCursor();
+}
+
+void lcd_line2(void)
+{
+	lcdCursor = 16;
+	updateCursor();
+}
+
+void lcd_goto(unsigned char row, unsigned char column)
+{
+	// Boundary checks on row and column
+	if(row < 1) row = 1;
+	if(row > 2) row = 2;
+	if(column < 1) column = 1;
+	if(column > 16) column  = 16;
+	lcdCursor = ((row - 1) << 4) | (column - 1);
+	updateCursor();
+}
+
+void lcd_move(char row, char column)
+{
+	// Add row and column to current cursor (row mod 2, column mod 16)
+	uint8_t newRow = ((lcdCursor >> 4) + (row + 1)) & 1;
+	uint8_t newCol = (lcdCursor + (column + 15)) & 0x0f;
+	lcdCursor = (newRow << 4) | newCol;
+	updateCursor();
+}
+
+void lcd_back(void)
+{
+	if(lcdCursor == 0)
+		lcdCursor = 31;
+	else
+		lcdCursor--;
+	updateCursor();
+}
+
+void lcd_home(void)
+{
+	lcdCursor &= 0x10;
+	updateCursor();
+}
+
+void lcd_forward(void)
+{
+	if(lcdCursor == 31)
+		lcdCursor = 0;
+	else
+		lcdCursor++;
+	updateCursor();
+}
+
+//-----------------------------------------------------------------------------
+// Erasing
+
+void lcd_clear(void)
+{
+#if (defined LCD_MARQUEE) && (defined LCD_FRAMEBUFFER)
+	// The framebuffer knows nothing about the shifted display and the
+	// marquee in DDRAM, so the LCD needs to be cleared for real
+	if(marqueePeriod)
+	{
+		marqueePeriod = 0;
+		SEND_BYTE(0, 0b00000001, 1640);
+	}
+#endif
+#ifdef LCD_FRAMEBUFFER
+	// Only cells that are not empty yet need to be sent
+	for(uint8_t cell = 0; cell < 32; cell++)
+		setCell(cell, ' ');
+#else
+	// "Clear Display" command (also returns cursor to 0): 0 0 0 0 0 0 0 1
+	SEND_BYTE(0, 0b00000001, 1640);
+#ifdef SHADOW
+	for(uint8_t cell = 0; cell < 32; cell++)
+		lcdFrame[cell] = ' ';
+#endif
+#endif
+	cleared();
+}
+
+void lcd_erase(uint8_t line)
+{
+	// Save current cursor position
+	uint8_t cursorBackup = lcdCursor;
+	// Erase the given line
+	lcd_goto(line, 1);
+#ifdef LCD_FINE_BAR
+	fineBarLevel[lcdCursor >> 4] = 0;
+#endif
+#ifdef LCD_BIG_DIGITS
+	bigColumn = 0xff;
+#endif
+#ifdef LCD_FIELDS
+	fieldDirty = 0xff;
+#endif
+	lcd_writeProgString(PSTR("                "));
+	// Set cursor back to original position
+	lcdCursor = cursorBackup;
+	updateCursor();
+}
+
+//-----------------------------------------------------------------------------
+// Writing
+
+void lcd_writeChar(char character)
+{
+	uint8_t c = character;
+	uint8_t lcdCode;
+	if(c < 0x80)
+	{
+		// ASCII, which is the bulk of everything written. An incomplete
+		// UTF-8 character before it is dropped. 
+		utf8Pending = 0;
+		if(c == '\n')
+		{
+			newLine();
+			return;
+		}
+		lcdCode = c;
+#if (!defined LCD_ROM_A02) && ((defined LCD_CC_BACKSLASH) || (defined LCD_CC_TILDE))
+		// The only ASCII characters missing from ROM A00
+		if(c == '\\' || c == '~')
+			lcdCode = mapCodePoint(c);
+#endif
+	}
+	else
+	{
+		// Decode UTF-8
+		if((c & 0xc0) == 0x80)
+		{
+			// Continuation byte (10xxxxxx)
+			if(!utf8Pending)
+				// Stray continuation byte, ignore it
+				return;
+			utf8CodePoint = (utf8CodePoint << 6) | (c & 0x3f);
+			if(--utf8Pending & 0x7f)
+				// Wait for more before writing
+				return;
+			lcdCode = utf8Pending ? LCD_CHARMAP_UNKNOWN : mapCodePoint(utf8CodePoint);
+			utf8Pending = 0;
+		}
+		else if((c & 0xe0) == 0xc0)
+		{
+			// Start of 2-byte character (110xxxxx 10xxxxxx)
+			utf8CodePoint = c & 0x1f;
+			utf8Pending = 1;
+			return;
+		}
+		else if((c & 0xf0) == 0xe0)
+		{
+			// Start of 3-byte character (1110xxxx 10xxxxxx 10xxxxxx)
+			utf8CodePoint = c & 0x0f;
+			utf8Pending = 2;
+			return;
+		}
+		else if((c & 0xf8) == 0xf0)
+		{
+			// Start of 4-byte character (11110xxx 10xxxxxx 10xxxxxx 10xxxxxx)
+			utf8Pending = 0x80 | 3;
+			return;
+		}
+		else
+		{
+			// Not valid in UTF-8
+			utf8Pending = 0;
+			lcdCode = LCD_CHARMAP_UNKNOWN;
+		}
+	}
+
+	writeCode(lcdCode);
+}
+
+void lcd_writeHexNibble(uint8_t number)
+{
+	number &= 0x0f;
+	lcd_writeChar(number <= 9 ? '0' + number : 'a' + number - 10);
+}
+
+void lcd_writeHexByte(uint8_t number)
+{
+	lcd_writeHexNibble(number >> 4);
+	lcd_writeHexNibble(number & 0x0f);
+}
+
+void lcd_writeHexWord(uint16_t number)
+{
+	lcd_writeHexByte(number >> 8);
+	lcd_writeHexByte(number & 0x00ff);
+}
+
+void lcd_writeHex(uint16_t number)
+{
+	if(number == 0)
+		// The only number where a leading zero is ok
+		lcd_writeChar('0');
+	else
+	{
+		int8_t shift = 8 * sizeof(number) - 4;
+		while((number >> shift) == 0)
+			shift -= 4;
+		while(shift >= 0)
+		{
+			lcd_writeHexNibble((number >> shift) & 0xf);
+			shift -= 4;
+		}
+	}
+}
+
+void lcd_write32bitHex(uint32_t number)
+{
+	lcd_writeProgString(PSTR("0x"));
+	lcd_writeHexWord(number >> 16);
+	lcd_writeHexWord(number & 0x0000ffff);
+}
+
+void lcd_writeDec(uint16_t number)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	writeAscii(formatDec16(buffer, number));
+}
+
+void lcd_writeDec32(uint32_t number)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	writeAscii(formatDec32(buffer, number));
+}
+
+void lcd_writeSignedDec(int32_t number)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	writeAscii(formatSignedDec32(buffer, number));
+}
+
+void lcd_writeFixed(int32_t value, uint8_t decimals)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	writeAscii(formatFixed(buffer, value, decimals));
+}
+
+void lcd_printf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	formatPrint(lcd_writeChar, format, args);
+	va_end(args);
+}
+
+void lcd_printf_P(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	formatPrint_P(lcd_writeChar, format, args);
+	va_end(args);
+}
+
+void lcd_writeString(const char* text)
+{
+	while(*text)
+		lcd_writeChar(*text++);
+}
+
+void lcd_write(const char* text, uint8_t length)
+{
+	while(length--)
+	{
+		uint8_t c = *text++;
+		// Plain ASCII goes straight to the LCD, everything else (including
+		// the rest of a UTF-8 character) through lcd_writeChar()
+		if(c >= 0x80 || c == '\n' || utf8Pending
+#if (!defined LCD_ROM_A02) && ((defined LCD_CC_BACKSLASH) || (defined LCD_CC_TILDE))
+		   || c == '\\' || c == '~'
+#endif
+		  )
+			lcd_writeChar(c);
+		else
+			writeCode(c);
+	}
+}
+
+/**
+ * \brief Nesting depth of lcd_beginBatch()
+ */
+static uint8_t batchDepth = 0;
+
+/**
+ * \brief SREG before the outermost lcd_beginBatch()
+ */
+static uint8_t batchSreg;
+
+void lcd_beginBatch(void)
+{
+	if(batchDepth++ == 0)
+		batchSreg = atomicBegin();
+	LOCK();
+}
+
+void lcd_endBatch(void)
+{
+	// Without a matching lcd_beginBatch(), the lock and the depth would
+	// underflow
+	if(!batchDepth)
+		return;
+	UNLOCK();
+	if(--batchDepth == 0)
+		atomicEnd(&batchSreg);
+}
+
+void lcd_writeProgString(const char* string)
+{
+	char c;
+	while((c = pgm_read_byte(string++)))
+		lcd_writeChar(c);
+}
+
+void lcd_writeErrorProgString(const char* string)
+{
+	fputs_P(string, stderr);
+}
+
+void lcd_writeRawProgString(const char* string)
+{
+	uint8_t c;
+	while((c = pgm_read_byte(string++)))
+	{
+		if(c == '\n')
+			newLine();
+		else
+			writeCode(c);
+	}
+}
+
+void lcd_drawBar(uint8_t percent)
+{
+	// Transform linearly from [0;100] to [0;16]
+	if(percent > 100) percent = 100;
+	percent = (uint8_t)((uint16_t)percent * 16 / 100);
+	// Clear screen and draw bar in first line
+	lcd_line1();
+	while(percent--)
+		lcd_writeProgString(PSTR("▮"));
+	while(lcdCursor < 16)
+		lcd_writeChar(' ');
+	lcd_erase(2);
+}
+
+#ifdef LCD_FINE_BAR
+void lcd_drawFineBar(uint8_t row, uint8_t level)
+{
+	// Boundary checks on row and level
+	if(row < 1) row = 1;
+	if(row > 2) row = 2;
+	if(level > 80) level = 80;
+
+	// Only the cells between the previous and the new end of the bar change
+	uint8_t low = fineBarLevel[row - 1];
+	uint8_t high = level;
+	if(low > high)
+	{
+		high = low;
+		low = level;
+	}
+	fineBarLevel[row - 1] = level;
+	if(low == high)
+		return;
+	uint8_t cell = (row - 1) << 4;
+	for(uint8_t column = low / 5; column <= (high - 1) / 5; column++)
+	{
+		// Number of filled pixel columns in this cell
+		uint8_t start = 5 * column;
+		uint8_t lcdCode;
+		if(level <= start)
+			lcdCode = ' ';
+		else if(level >= start + 5)
+			lcdCode = FINE_BAR_FULL;
+		else
+			lcdCode = (LCD_FINE_BAR_CC) + (level - start - 1);
+#ifdef SHADOW
+		setCell(cell | column, lcdCode);
+#else
+		writeCell(cell | column, lcdCode);
+#endif
+	}
+}
+#endif
+
+#ifdef LCD_BIG_DIGITS
+void lcd_writeBigDec(uint16_t value, uint8_t column)
+{
+	if(column < 1) column = 1;
+	if(column > 14) column = 14;
+	column--;
+	// Number of digits that fit, 4 columns each (including a gap, which the
+	// last digit can do without)
+	uint8_t count = (16 + 1 - column) / 4;
+	// Split the number into digits, the least significant one first
+	uint8_t digits[4];
+	char buffer[FORMAT_BUFFER_SIZE];
+	char* end = buffer + FORMAT_BUFFER_SIZE - 1;
+	char* p = formatDec16(buffer, value);
+	for(uint8_t i = 0; i < count; i++)
+		digits[i] = end - i > p ? end[-1 - i] - '0' : 10;
+	// Without knowing what is on the screen, all cells have to be drawn
+	uint8_t known = (column == bigColumn);
+	bigColumn = column;
+
+	for(uint8_t i = 0; i < count; i++)
+	{
+		uint8_t digit = digits[i];
+		uint8_t* previous = &bigDigits[i];
+		if(known && *previous == digit)
+			continue;
+		const uint8_t* shape = bigShapes[digit];
+		const uint8_t* oldShape = bigShapes[*previous];
+		*previous = digit;
+		uint8_t cell = column + 4 * (count - 1 - i);
+		for(uint8_t j = 0; j < 6; j++)
+		{
+			uint8_t lcdCode = pgm_read_byte(shape + j);
+			// Leave cells alone that look the same in the old digit
+			if(!known || lcdCode != pgm_read_byte(oldShape + j))
+			{
+				uint8_t position = cell + (j < 3 ? j : 16 + j - 3);
+#ifdef SHADOW
+				setCell(position, lcdCode);
+#else
+				writeCell(position, lcdCode);
+#endif
+			}
+		}
+	}
+}
+#endif
+
+void lcd_writeVoltage(uint16_t voltage, uint16_t valueUpperBound, uint8_t voltUpperBound)
+{
+	// Calculate the voltage in millivolts
+	uint16_t millivolts = (uint16_t)((uint32_t)voltage * 1000 * voltUpperBound / valueUpperBound);
+
+	// Write to display
+	lcd_writeFixed(millivolts, 3);
+	writeCode('V');
+}
+
+#ifdef LCD_CONSOLE
+uint8_t lcd_scrollBack(uint8_t lines)
+{
+	if(lines > scrollbackCount)
+		lines = scrollbackCount;
+	showConsole(lines);
+	return lines;
+}
+#endif
+
+#ifdef LCD_FRAMEBUFFER
+/**
+ * \brief Sends the dirty cells to the LCD, see lcd_flush()
+ * \return Non-zero if anything was sent
+ */
+static uint8_t flush(void)
+{
+	uint32_t dirty;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		dirty = lcdDirty;
+		lcdDirty = 0;
+#ifdef LCD_GLYPH_CACHE
+		flushSlots = 0;
+#endif
+	}
+	uint8_t sent = dirty != 0;
+	for(uint8_t cell = 0; dirty; cell++, dirty >>= 1)
+	{
+		if(!(dirty & 1))
+			continue;
+		// Start of a new run of dirty cells, move the address counter there
+		uint8_t address = cellAddress(cell);
+		if(address != lcdAddress)
+			// "Set DDRAM address" command: 1 A6 A5 A4 A3 A2 A1 A0
+			SEND_BYTE(0, 0b10000000 | address, 42);
+		SEND_BYTE(1, lcdFrame[cell], 46);
+	}
+	return sent;
+}
+#endif
+
+void lcd_flush(void)
+{
+#ifdef LCD_FRAMEBUFFER
+	LOCK();
+	flush();
+	UNLOCK();
+#endif
+}
+
+#ifdef LCD_FIELDS
+//-----------------------------------------------------------------------------
+// Fields
+
+uint32_t lcd_fieldsSaved = 0;
+
+void lcd_setFields(const lcd_field_t* fields_P, uint8_t count)
+{
+	if(count > LCD_FIELDS)
+		count = LCD_FIELDS;
+	fields = fields_P;
+	fieldCount = count;
+	// Anything beyond the end of the line would end up in the next one or
+	// outside of lcdFrame, and formatFixed() only handles up to 10 decimals
+	fieldMisfit = 0;
+	for(uint8_t i = 0; i < count; i++)
+	{
+		uint8_t cell = pgm_read_byte(&fields_P[i].cell);
+		uint8_t width = pgm_read_byte(&fields_P[i].width);
+		uint8_t decimals = pgm_read_byte(&fields_P[i].decimals);
+		if(cell >= 32 || width > 16 - (cell & 0x0f) || decimals > 10)
+			fieldMisfit |= 1 << i;
+	}
+	fieldDirty = 0xff;
+}
+
+void lcd_setField(uint8_t index, int32_t value)
+{
+	if(index >= LCD_FIELDS)
+		return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if(fieldValues[index] != value)
+		{
+			fieldValues[index] = value;
+			fieldDirty |= 1 << index;
+		}
+	}
+}
+
+void lcd_updateFields(void)
+{
+	uint8_t dirty;
+	for(uint8_t i = 0; i < fieldCount; i++)
+	{
+		// Take the value and the dirty flag together, an interrupt might set
+		// a new one in between
+		int32_t value;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			dirty = fieldDirty & (1 << i);
+			fieldDirty &= ~(1 << i);
+			value = fieldValues[i];
+		}
+		if(!dirty || (fieldMisfit & (1 << i)))
+			continue;
+
+		// Right-aligned text, or all '#' if it doesn't fit
+		uint8_t cell = pgm_read_byte(&fields[i].cell);
+		uint8_t width = pgm_read_byte(&fields[i].width);
+		char buffer[FORMAT_BUFFER_SIZE];
+		const char* text = formatFixed(buffer, value, pgm_read_byte(&fields[i].decimals));
+		uint8_t length = buffer + FORMAT_BUFFER_SIZE - 1 - text;
+		for(uint8_t j = 0; j < width; j++, cell++)
+		{
+			uint8_t lcdCode;
+			if(length > width)
+				lcdCode = '#';
+			else if(j < width - length)
+				lcdCode = ' ';
+			else
+				lcdCode = *text++;
+			// Only characters that differ from the screen are sent
+			if(lcdFrame[cell] == lcdCode)
+				lcd_fieldsSaved++;
+			else
+				setCell(cell, lcdCode);
+		}
+	}
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Custom characters
+
+void lcd_registerCustomChar(uint8_t addr, uint64_t chr)
+{
+	LOCK();
+	// "Set CGRAM address" command: 0 1 A5 A4 A3 A2 A1 A0
+	// with A[5:0]=the byte address in CGRAM (each character takes 8 bytes)
+	SEND_BYTE(0, 0b01000000 | (8 * addr), 42);
+	// Write 8 bytes of data
+	for(uint8_t i = 0; i < 8; i++)
+	{
+		SEND_BYTE(1, (uint8_t)chr, 46);
+		chr >>= 8;
+	}
+	// Move address pointer back to DDRAM, otherwise all following data writes
+	// would go into CGRAM. 
+	updateCursor();
+	UNLOCK();
+#ifdef LCD_GLYPH_CACHE
+	// Whatever the glyph cache had put there is gone now
+	slotGlyph[addr & 0x07] = NO_GLYPH;
+#endif
+}
+
+void lcd_registerCustomChars_P(uint8_t firstAddr, const uint8_t* glyphs_P, uint8_t count)
+{
+	uploadGlyphs(firstAddr, glyphs_P, count);
+#ifdef LCD_GLYPH_CACHE
+	// Whatever the glyph cache had put there is gone now
+	while(count--)
+		slotGlyph[(firstAddr + count) & 0x07] = NO_GLYPH;
+#endif
+}
+
+#ifdef LCD_GLYPH_CACHE
+void lcd_setGlyphTable(const uint8_t* table)
+{
+	glyphTable = table;
+	// IDs refer to the new table now, so nothing in CGRAM can be reused
+	for(uint8_t slot = 0; slot < 8; slot++)
+		if((LCD_GLYPH_CACHE_SLOTS) & (1 << slot))
+			slotGlyph[slot] = NO_GLYPH;
+}
+
+uint8_t lcd_glyph(uint8_t id)
+{
+	return glyphSlot(id);
+}
+
+void lcd_writeGlyph(uint8_t id)
+{
+	writeCode(glyphSlot(id));
+}
+#endif
+
+#ifdef LCD_ANIMATION
+//-----------------------------------------------------------------------------
+// Animation
+
+void lcd_animate(uint8_t addr, const uint8_t* frames_P, uint8_t count, uint8_t period)
+{
+	addr &= 0x07;
+	// Reuse the entry of an animation in the same slot, otherwise take a free
+	// one
+	animation_t* entry = 0;
+	for(animation_t* a = animations; a < animations + LCD_ANIMATIONS; a++)
+	{
+		if(a->frames && a->slot == addr)
+		{
+			entry = a;
+			break;
+		}
+		if(!a->frames && !entry)
+			entry = a;
+	}
+	if(!entry)
+		return;
+	// Stop lcd_tick() from touching the entry while it is being changed
+	entry->frames = 0;
+	if(!frames_P || !count)
+		return;
+	// Show the first frame right away
+	lcd_registerCustomChars_P(addr, frames_P, 1);
+	entry->slot = addr;
+	entry->count = count;
+	entry->frame = 0;
+	entry->period = period ? period : 1;
+	entry->countdown = entry->period;
+	entry->frames = frames_P;
+}
+#endif
+
+#ifdef LCD_CHART
+//-----------------------------------------------------------------------------
+// Chart
+
+void lcd_writeChart(void)
+{
+	for(uint8_t i = 0; i < LCD_CHART_CELLS; i++)
+		writeCode((LCD_CHART_CC) + i);
+}
+
+void lcd_updateChart(const uint8_t* samples, uint8_t first)
+{
+	LOCK();
+	// Byte of chartRows the LCD's CGRAM address counter points to
+	uint8_t next = 0xff;
+	// Byte of chartRows being computed
+	uint8_t i = 0;
+	uint8_t sample = first;
+	for(uint8_t cell = 0; cell < LCD_CHART_CELLS; cell++)
+	{
+		// Sort the five columns of the cell by height: bit 4-x of
+		// columns[h] is set if column x is h pixels high
+		uint8_t columns[9] = {0};
+		for(uint8_t bit = 0b10000; bit; bit >>= 1)
+		{
+			uint8_t height = samples[sample];
+			columns[height > 8 ? 8 : height] |= bit;
+			if(++sample == LCD_CHART_WIDTH)
+				sample = 0;
+		}
+		// From the top down, every row adds the columns that reach up to it
+		uint8_t set = 0;
+		for(uint8_t row = 0; row < 8; row++, i++)
+		{
+			set |= columns[8 - row];
+			// Only send rows that differ from what is in CGRAM
+			if(chartRows[i] == set)
+				continue;
+			chartRows[i] = set;
+			if(i != next)
+				// "Set CGRAM address" command: 0 1 A5 A4 A3 A2 A1 A0
+				SEND_BYTE(0, 0b01000000 | (8 * (LCD_CHART_CC) + i), 42);
+			SEND_BYTE(1, set, 46);
+			next = i + 1;
+		}
+	}
+	// Move address pointer back to DDRAM if it was moved into CGRAM
+	if(next != 0xff)
+		updateCursor();
+	UNLOCK();
+}
+#endif
+
+#ifdef LCD_MARQUEE
+//-----------------------------------------------------------------------------
+// Marquee
+
+void lcd_marquee(const char* line1_P, const char* line2_P, uint8_t period)
+{
+	// Keep lcd_tick() from scrolling while the text is being loaded
+	marqueePeriod = 0;
+	LOCK();
+	// "Return home" command (also undoes the shift): 0 0 0 0 0 0 1 *
+	SEND_BYTE(0, 0b00000010, 1640);
+	const char* texts[2] = {line1_P, line2_P};
+	for(uint8_t line = 0; line < 2; line++)
+	{
+		marquee_t* m = &marquees[line];
+		size_t length = texts[line] ? strlen_P(texts[line]) : 0;
+		m->text = texts[line];
+		m->textLength = length > 255 ? 255 : length;
+		m->length = m->textLength > 40 ? m->textLength : 40;
+		m->next = m->length == 40 ? 0 : 40;
+		// Fill all 40 columns. After the last column of the first line, the
+		// address counter continues with the second line. 
+		for(uint8_t position = 0; position < 40; position++)
+			SEND_BYTE(1, marqueeChar(m, position), 46);
+	}
+	marqueeShift = 0;
+	UNLOCK();
+	marqueeCountdown = period ? period : 1;
+	marqueePeriod = marqueeCountdown;
+}
+#endif
+
+#ifdef TICK
+//-----------------------------------------------------------------------------
+// Background work
+
+void lcd_tick(void)
+{
+	// Don't get in the way of a transfer in progress, try again next time
+	if(lcdLock)
+		return;
+	LOCK();
+	uint8_t address = lcdAddress;
+	uint8_t changed = 0;
+#ifdef LCD_ANIMATION
+	changed |= animate();
+#endif
+#ifdef LCD_MARQUEE
+	changed |= scrollMarquee();
+#endif
+#ifdef LCD_FRAME_RATE
+	if(--frameCountdown == 0)
+	{
+		frameCountdown = FRAME_TICKS;
+		changed |= flush();
+	}
+#endif
+	// Put the address counter back where the interrupted code expects it
+	if(changed)
+	{
+		if(address == ADDRESS_UNKNOWN)
+			updateCursor();
+		else if(lcdAddress != address)
+			SEND_BYTE(0, 0b10000000 | address, 42);
+	}
+	UNLOCK();
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Miscellaneous
+
+/**
+ * \brief Pointer to FILE through which stdio functions can write to the LCD
+ */
+FILE* lcdout = &lcdOut;
+
+void lcd_command(uint8_t command)
+{
+	SEND_BYTE(0, command, 1640 /* maximum delay for safety */);
+}
+
+#ifdef LCD_ASYNC
+uint8_t lcd_queueDepth(void)
+{
+	uint8_t depth;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		depth = (queueHead - queueTail) & ((LCD_ASYNC_QUEUE_SIZE) - 1);
+	}
+	return depth;
+}
+
+uint8_t lcd_queueHighWater(void)
+{
+	return queueHighWater;
+}
+#endif
+
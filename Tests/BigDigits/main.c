@@ -0,0 +1,31 @@
+/*
+ * Testing the big digits of the LCD driver
+ *
+ * Connect the LCD the same way as for the LCD test (see Tests/LCD/main.c). 
+ * 
+ * 8888 is drawn at every start column from 1 to 14, each time on a cleared
+ * screen, and as many digits as fit are shown. The number has to end exactly
+ * at the end of the line. Without a framebuffer, anything the driver wrote
+ * past column 16 would wrap around to the start of a line, so the columns
+ * left of the first digit must stay empty. 
+ */
+
+#include<avr/io.h>
+#include<util/delay.h>
+#include"lcd.h"
+
+void main(void)
+{
+	// Initialisation
+	lcd_init();
+
+	while(1)
+	{
+		for(uint8_t column = 1; column <= 14; column++)
+		{
+			lcd_clear();
+			lcd_writeBigDec(8888, column);
+			_delay_ms(1000);
+		}
+	}
+}
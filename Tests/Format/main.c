@@ -0,0 +1,169 @@
+/*
+ * Benchmark of the number formatting module
+ *
+ * Place both jumpers on JP4 and attach the serial port (J10) to a computer
+ * with a serial cable or a USB to serial converter.
+ * Start a serial terminal program on the corresponding port and configure
+ * it to 250kBaud (250000 Baud), 8 data bits, no parity, 1 stop bit (8N1),
+ * and no flow control.
+ *
+ * Timer1 runs at the CPU's clock speed and is used to count the CPU cycles
+ * each conversion takes. For comparison, the same conversions are also done
+ * the conventional way, i.e. with one software division per digit. The
+ * results are printed as a table.
+ */
+
+#include<avr/io.h>
+#include<avr/pgmspace.h>
+#include<util/atomic.h>
+#include"format.h"
+#include"serial.h"
+
+// Keeps the compiler from optimising the conversions away
+volatile char sink;
+
+// Conventional conversion of an unsigned 16-bit number (libgcc division)
+__attribute__((noinline)) static char* divDec16(char* buffer, uint16_t number)
+{
+	char* p = buffer + FORMAT_BUFFER_SIZE - 1;
+	*p = 0;
+	do
+	{
+		*--p = '0' + number % 10;
+		number /= 10;
+	}
+	while(number);
+	return p;
+}
+
+// Conventional conversion of an unsigned 32-bit number (libgcc division)
+__attribute__((noinline)) static char* divDec32(char* buffer, uint32_t number)
+{
+	char* p = buffer + FORMAT_BUFFER_SIZE - 1;
+	*p = 0;
+	do
+	{
+		*--p = '0' + number % 10;
+		number /= 10;
+	}
+	while(number);
+	return p;
+}
+
+// Conventional conversion of a signed 32-bit number (libgcc division)
+__attribute__((noinline)) static char* divSignedDec32(char* buffer, int32_t number)
+{
+	char* p = divDec32(buffer, number < 0 ? -(uint32_t)number : (uint32_t)number);
+	if(number < 0)
+		*--p = '-';
+	return p;
+}
+
+// Conventional conversion of a number with three decimals (libgcc division),
+// the way lcd_writeVoltage() used to do it
+__attribute__((noinline)) static char* divFixed3(char* buffer, int32_t value)
+{
+	uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+	uint16_t fraction = magnitude % 1000;
+	char* p = buffer + FORMAT_BUFFER_SIZE - 5;
+	p[0] = '.';
+	p[1] = '0' + fraction / 100;
+	p[2] = '0' + fraction / 10 % 10;
+	p[3] = '0' + fraction % 10;
+	p[4] = 0;
+	char digits[FORMAT_BUFFER_SIZE];
+	char* integer = divDec32(digits, magnitude / 1000);
+	char* end = digits + FORMAT_BUFFER_SIZE - 1;
+	while(end > integer)
+		*--p = *--end;
+	if(value < 0)
+		*--p = '-';
+	return p;
+}
+
+// Number of cycles it takes to read TCNT1 twice
+static uint16_t overhead;
+
+// Measures the number of cycles an expression takes
+#define CYCLES(expression) ({ \
+	uint16_t start, end; \
+	ATOMIC_BLOCK(ATOMIC_FORCEON) \
+	{ \
+		start = TCNT1; \
+		sink = *(expression); \
+		end = TCNT1; \
+	} \
+	(uint16_t)(end - start - overhead); \
+})
+
+// Prints one line of the table
+static void report(const char* label, const char* result, uint16_t cycles, uint16_t divCycles)
+{
+	serialTransmitProgString(label);
+	serialTransmitString(result);
+	serialTransmitProgString(PSTR(": "));
+	serialTransmitDec(cycles);
+	serialTransmitProgString(PSTR(" cycles (with division: "));
+	serialTransmitDec(divCycles);
+	serialTransmitProgString(PSTR(")\r\n"));
+}
+
+void main(void)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+
+	// Initialisation
+	serialInit();
+	// Timer1 in normal mode with prescaler 1, i.e. counting CPU cycles
+	TCCR1A = 0;
+	TCCR1B = (0b001 << CS10);
+	{
+		uint16_t start, end;
+		ATOMIC_BLOCK(ATOMIC_FORCEON)
+		{
+			start = TCNT1;
+			end = TCNT1;
+		}
+		overhead = end - start;
+	}
+
+	serialTransmitProgString(PSTR("Number formatting benchmark\r\n"));
+
+	static const uint16_t values16[] PROGMEM = {0, 9, 1234, 65535};
+	for(uint8_t i = 0; i < sizeof(values16) / sizeof(values16[0]); i++)
+	{
+		uint16_t value = pgm_read_word(&values16[i]);
+		uint16_t divCycles = CYCLES(divDec16(buffer, value));
+		uint16_t cycles = CYCLES(formatDec16(buffer, value));
+		report(PSTR("formatDec16 "), formatDec16(buffer, value), cycles, divCycles);
+	}
+
+	static const uint32_t values32[] PROGMEM = {1234, 65536, 1234567, 4294967295};
+	for(uint8_t i = 0; i < sizeof(values32) / sizeof(values32[0]); i++)
+	{
+		uint32_t value = pgm_read_dword(&values32[i]);
+		uint16_t divCycles = CYCLES(divDec32(buffer, value));
+		uint16_t cycles = CYCLES(formatDec32(buffer, value));
+		report(PSTR("formatDec32 "), formatDec32(buffer, value), cycles, divCycles);
+	}
+
+	static const int32_t valuesSigned[] PROGMEM = {-1234, -1234567, INT32_MIN};
+	for(uint8_t i = 0; i < sizeof(valuesSigned) / sizeof(valuesSigned[0]); i++)
+	{
+		int32_t value = (int32_t)pgm_read_dword(&valuesSigned[i]);
+		uint16_t divCycles = CYCLES(divSignedDec32(buffer, value));
+		uint16_t cycles = CYCLES(formatSignedDec32(buffer, value));
+		report(PSTR("formatSignedDec32 "), formatSignedDec32(buffer, value), cycles, divCycles);
+	}
+
+	static const int32_t valuesFixed[] PROGMEM = {4999, -1234567};
+	for(uint8_t i = 0; i < sizeof(valuesFixed) / sizeof(valuesFixed[0]); i++)
+	{
+		int32_t value = (int32_t)pgm_read_dword(&valuesFixed[i]);
+		uint16_t divCycles = CYCLES(divFixed3(buffer, value));
+		uint16_t cycles = CYCLES(formatFixed(buffer, value, 3));
+		report(PSTR("formatFixed "), formatFixed(buffer, value, 3), cycles, divCycles);
+	}
+
+	while(1);
+}
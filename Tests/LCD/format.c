@@ -0,0 +1,237 @@
+/**
+ * \file format.c
+ * \brief See format.h for details.
+ */
+
+#include<avr/pgmspace.h>
+#include<string.h>
+#include"format.h"
+
+/**
+ * \brief Divides a 16-bit number by 10
+ *
+ * 0xcccd / 2^19 is close enough to 1/10 for the result to be exact for all
+ * 16-bit numbers. The multiplication is a single 16x16->32 bit hardware
+ * multiplication.
+ */
+static inline uint16_t div10(uint16_t n)
+{
+	return (uint16_t)(((uint32_t)n * 0xcccd) >> 19);
+}
+
+/**
+ * \brief Divides a 32-bit number by 10
+ *
+ * Approximates n * 0.8 with shifts and additions, divides by 8 and corrects
+ * the result using the remainder (see "Hacker's Delight", section 10-17).
+ */
+static uint32_t div10_32(uint32_t n)
+{
+	uint32_t q = (n >> 1) + (n >> 2);
+	q += q >> 4;
+	q += q >> 8;
+	q += q >> 16;
+	q >>= 3;
+	// The remainder is between 0 and 19, so 8 bits are enough
+	uint8_t r = (uint8_t)n - (uint8_t)q * 10;
+	if(r > 9)
+		q++;
+	return q;
+}
+
+/**
+ * \brief Writes the decimal digits of a number backwards
+ *
+ * \param end Where the terminating 0 goes
+ * \param number The number to be converted
+ * \param decimals Number of digits after the decimal point (0 means there is
+ * no decimal point)
+ * \return Pointer to the first digit
+ */
+static char* writeDigits(char* end, uint32_t number, uint8_t decimals)
+{
+	char* p = end;
+	*p = 0;
+	uint8_t digits = 0;
+	// Only use the slow 32-bit division while the number needs it
+	while(number > 0xffff)
+	{
+		uint32_t q = div10_32(number);
+		*--p = '0' + (uint8_t)((uint8_t)number - (uint8_t)q * 10);
+		if(++digits == decimals)
+			*--p = '.';
+		number = q;
+	}
+	uint16_t n = (uint16_t)number;
+	// Continue until the number is used up, but write at least one digit
+	// before the decimal point
+	do
+	{
+		uint16_t q = div10(n);
+		*--p = '0' + (uint8_t)((uint8_t)n - (uint8_t)q * 10);
+		if(++digits == decimals)
+			*--p = '.';
+		n = q;
+	}
+	while(n || digits <= decimals);
+	return p;
+}
+
+char* formatDec16(char* buffer, uint16_t number)
+{
+	return writeDigits(buffer + FORMAT_BUFFER_SIZE - 1, number, 0);
+}
+
+char* formatDec32(char* buffer, uint32_t number)
+{
+	return writeDigits(buffer + FORMAT_BUFFER_SIZE - 1, number, 0);
+}
+
+char* formatSignedDec32(char* buffer, int32_t number)
+{
+	return formatFixed(buffer, number, 0);
+}
+
+char* formatFixed(char* buffer, int32_t value, uint8_t decimals)
+{
+	// More wouldn't fit into the buffer
+	if(decimals > 10)
+		decimals = 10;
+	// Convert the magnitude (as unsigned, so that -2^31 works, too)
+	uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+	char* p = writeDigits(buffer + FORMAT_BUFFER_SIZE - 1, magnitude, decimals);
+	if(value < 0)
+		*--p = '-';
+	return p;
+}
+
+/**
+ * \brief Converts a number to hexadecimal (lower case)
+ *
+ * \param buffer Buffer of FORMAT_BUFFER_SIZE characters
+ * \param number The number to be converted
+ * \return Pointer to the result inside buffer
+ */
+static char* formatHex32(char* buffer, uint32_t number)
+{
+	char* p = buffer + FORMAT_BUFFER_SIZE - 1;
+	*p = 0;
+	do
+	{
+		uint8_t nibble = (uint8_t)number & 0x0f;
+		*--p = nibble <= 9 ? '0' + nibble : 'a' + nibble - 10;
+		number >>= 4;
+	}
+	while(number);
+	return p;
+}
+
+/**
+ * \brief Implementation of formatPrint() and formatPrint_P()
+ *
+ * \param put Function that outputs one character
+ * \param format The format string
+ * \param progmem Non-zero if format is in program memory
+ * \param args The values to be converted
+ */
+static void print(format_put_t put, const char* format, uint8_t progmem, va_list args)
+{
+	char buffer[FORMAT_BUFFER_SIZE];
+	char c;
+	while((c = progmem ? pgm_read_byte(format) : *format))
+	{
+		format++;
+		if(c != '%')
+		{
+			put(c);
+			continue;
+		}
+
+		// Parse width and length modifier
+		char pad = ' ';
+		uint8_t width = 0;
+		uint8_t isLong = 0;
+		c = progmem ? pgm_read_byte(format++) : *format++;
+		if(c == '0')
+		{
+			pad = '0';
+			c = progmem ? pgm_read_byte(format++) : *format++;
+		}
+		while(c >= '0' && c <= '9')
+		{
+			width = 10 * width + (c - '0');
+			c = progmem ? pgm_read_byte(format++) : *format++;
+		}
+		if(c == 'l')
+		{
+			isLong = 1;
+			c = progmem ? pgm_read_byte(format++) : *format++;
+		}
+
+		// Convert the value into a string
+		const char* text = buffer;
+		uint8_t textProgmem = 0;
+		switch(c)
+		{
+		case 'd':
+			text = formatSignedDec32(buffer, isLong ? va_arg(args, int32_t) : va_arg(args, int));
+			break;
+		case 'u':
+			text = isLong ? formatDec32(buffer, va_arg(args, uint32_t)) : formatDec16(buffer, va_arg(args, unsigned int));
+			break;
+		case 'x':
+			text = formatHex32(buffer, isLong ? va_arg(args, uint32_t) : va_arg(args, unsigned int));
+			break;
+		case 'c':
+			buffer[0] = (char)va_arg(args, int);
+			buffer[1] = 0;
+			break;
+		case 's':
+			text = va_arg(args, const char*);
+			break;
+		case 'S':
+			text = va_arg(args, const char*);
+			textProgmem = 1;
+			break;
+		case 0:
+			// Format string ends with '%'
+			return;
+		default:
+			// "%%" and unsupported conversions are written as they are
+			put(c);
+			continue;
+		}
+
+		// Pad to the given width
+		uint8_t length = textProgmem ? strlen_P(text) : strlen(text);
+		if(pad == '0' && *text == '-')
+		{
+			// The sign goes before the zeros
+			put(*text++);
+			length--;
+			if(width)
+				width--;
+		}
+		while(width > length)
+		{
+			put(pad);
+			width--;
+		}
+		while((c = textProgmem ? pgm_read_byte(text) : *text))
+		{
+			put(c);
+			text++;
+		}
+	}
+}
+
+void formatPrint(format_put_t put, const char* format, va_list args)
+{
+	print(put, format, 0, args);
+}
+
+void formatPrint_P(format_put_t put, const char* format, va_list args)
+{
+	print(put, format, 1, args);
+}
+
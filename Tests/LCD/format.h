@@ -0,0 +1,115 @@
+/**
+ * \file format.h
+ * \brief Fast conversion of numbers to decimal strings for the ATmega644(A)
+ *
+ * The AVR has no division instruction, so the usual way of converting a
+ * number to decimal (divide by 10, take the remainder, repeat) calls the
+ * software division of libgcc once per digit. These functions divide by 10
+ * with a multiplication by the reciprocal (16 bits) or with shifts and
+ * additions (32 bits) instead, which is several times faster.
+ *
+ * All functions write their result backwards into a buffer of
+ * FORMAT_BUFFER_SIZE characters and return a pointer to its first character
+ * (which is somewhere inside the buffer). The result is 0-terminated.
+ *
+ * Copy format.h and format.c into your project. Then use it like so:
+ *
+ * #include"format.h"
+ * char buffer[FORMAT_BUFFER_SIZE];
+ * lcd_writeString(formatFixed(buffer, -1234, 2)); // Writes "-12.34"
+ *
+ * The LCD and serial drivers use this module for their number writers, so it
+ * must be copied along with them.
+ */
+
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include<stdarg.h>
+#include<stdint.h>
+
+/**
+ * \brief Size of the buffer passed to the conversion functions
+ *
+ * Enough for a sign, 10 digits, a decimal point, a leading 0 (for numbers
+ * below 1) and the terminating 0.
+ */
+#define FORMAT_BUFFER_SIZE 14
+
+/**
+ * \brief Converts an unsigned 16-bit number to decimal
+ *
+ * \param buffer Buffer of FORMAT_BUFFER_SIZE characters
+ * \param number The number to be converted
+ * \return Pointer to the result inside buffer
+ */
+char* formatDec16(char* buffer, uint16_t number);
+
+/**
+ * \brief Converts an unsigned 32-bit number to decimal
+ *
+ * \param buffer Buffer of FORMAT_BUFFER_SIZE characters
+ * \param number The number to be converted
+ * \return Pointer to the result inside buffer
+ */
+char* formatDec32(char* buffer, uint32_t number);
+
+/**
+ * \brief Converts a signed 32-bit number to decimal
+ *
+ * \param buffer Buffer of FORMAT_BUFFER_SIZE characters
+ * \param number The number to be converted
+ * \return Pointer to the result inside buffer
+ */
+char* formatSignedDec32(char* buffer, int32_t number);
+
+/**
+ * \brief Converts a fixed-point number to decimal
+ *
+ * The number is given as an integer multiple of 10^-decimals, e.g. a voltage
+ * in millivolts with decimals=3. There is always at least one digit before
+ * the decimal point, e.g. formatFixed(buffer, 5, 2) returns "0.05".
+ * \param buffer Buffer of FORMAT_BUFFER_SIZE characters
+ * \param value The number in units of 10^-decimals
+ * \param decimals Number of digits after the decimal point (0 means there is
+ * no decimal point, at most 10, more are treated as 10)
+ * \return Pointer to the result inside buffer
+ */
+char* formatFixed(char* buffer, int32_t value, uint8_t decimals);
+
+/**
+ * \brief Function that outputs one character, used by formatPrint()
+ */
+typedef void (*format_put_t)(char c);
+
+/**
+ * \brief Minimal replacement for vfprintf()
+ *
+ * Much smaller and faster than the avr-libc version, but only supports the
+ * following conversions:
+ * - %d, %u: int, unsigned int
+ * - %ld, %lu: long, unsigned long
+ * - %x, %lx: unsigned int, unsigned long in hexadecimal (lower case)
+ * - %c: char
+ * - %s: string in RAM
+ * - %S: string in program memory
+ * - %%: the percent sign itself
+ * Each conversion can have a minimum width (e.g. %5d). Numbers are padded
+ * with spaces, or with zeros if the width starts with 0 (e.g. %05d).
+ * \param put Function that outputs one character
+ * \param format The format string in RAM
+ * \param args The values to be converted
+ */
+void formatPrint(format_put_t put, const char* format, va_list args);
+
+/**
+ * \brief Like formatPrint() but with the format string in program memory
+ *
+ * \param put Function that outputs one character
+ * \param format The format string in program memory
+ * \param args The values to be converted
+ */
+void formatPrint_P(format_put_t put, const char* format, va_list args);
+
+#endif // _FORMAT_H
+
@@ -0,0 +1,23 @@
+/*
+ * The special characters of main.c once more, converted at compile time
+ * (see lcd_literal.h). They must look exactly the same. 
+ */
+
+#include<util/delay.h>
+#include"lcd_literal.h"
+
+extern "C" void writeLiterals(void)
+{
+	lcd_clear();
+	lcd_writeRawProgString(LCD_PSTR("Tilde: ~\nBackslash: \\"));
+	_delay_ms(1000);
+	lcd_clear();
+	lcd_writeRawProgString(LCD_PSTR("Left Arrow: ←\nRight Arrow: →"));
+	_delay_ms(1000);
+	lcd_clear();
+	lcd_writeRawProgString(LCD_PSTR("Umlaut: äöü\nGreek: αβεμσρθπ"));
+	_delay_ms(1000);
+	lcd_clear();
+	lcd_writeRawProgString(LCD_PSTR("Misc: ÷√⅟°∃□¢∞"));
+	_delay_ms(2000);
+}
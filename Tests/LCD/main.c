@@ -4,19 +4,183 @@
  * Connect the LCD (J15) to Port B (J12) with an 8-pole cable (twisted). That
  * is, connect R/W to Port B6, EN to Port B5, RS to Port B4, DB7 to Port B3,
  * DB6 to Port B2, DB5 to Port B1, and DB4 to Port B0. Attach a 2x16 LCD to J16. 
+ * Connect SW1 to Port C0 and SW2 to Port C1 (J6 to J13) with jumper cables. At
+ * the end, they scroll back and forth through the lines that have scrolled
+ * off the screen. 
+ * 
+ * Before that, Timer1 counts CPU cycles for a moment to show what
+ * lcd_writeChar() takes for an ASCII character and for a 2-byte UTF-8
+ * character (ä), compared with the way it used to decode UTF-8 and map
+ * characters with a switch statement. lcd_writeChar() only writes into the
+ * framebuffer here, the old way is timed without writing anything. 
  */
 
 #include<avr/io.h>
+#include<avr/interrupt.h>
+#include<avr/pgmspace.h>
+#include<util/atomic.h>
 #include<util/delay.h>
 #include"lcd.h"
 
+// Frames of the spinner animation
+const uint8_t spinner[] PROGMEM = {
+	0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0,
+	0b01000, 0b01000, 0b00100, 0b00100, 0b00100, 0b00010, 0b00010, 0,
+	0b10000, 0b10000, 0b01000, 0b00100, 0b00010, 0b00001, 0b00001, 0,
+	0b00000, 0b00000, 0b11000, 0b00100, 0b00011, 0b00000, 0b00000, 0,
+	0b00000, 0b00000, 0b00000, 0b11111, 0b00000, 0b00000, 0b00000, 0,
+	0b00000, 0b00000, 0b00011, 0b00100, 0b11000, 0b00000, 0b00000, 0,
+	0b00001, 0b00001, 0b00010, 0b00100, 0b01000, 0b10000, 0b10000, 0,
+	0b00010, 0b00010, 0b00100, 0b00100, 0b00100, 0b01000, 0b01000, 0
+};
+
+// Writes the special characters again with LCD_PSTR() (literal.cpp)
+void writeLiterals(void);
+
+// Keeps the compiler from optimising the old way away
+volatile uint8_t sink;
+
+// UTF-8 decoding and character mapping the way lcd_writeChar() used to do it
+// (for ROM A00), without writing the character
+static uint32_t utf8Buffer = 0;
+__attribute__((noinline)) static void switchWriteChar(char character)
+{
+	// Add to UTF-8 buffer
+	utf8Buffer = (utf8Buffer << 8) | (uint8_t)character;
+	// Check if the buffer now holds a complete UTF-8 character
+	uint32_t codePoint = 0x0000fffd; // Default for characters the LCD cannot display
+	if((utf8Buffer & 0xf8000000) == 0xf0000000)
+	{
+		// 4-byte character (11110xxx 10xxxxxx 10xxxxxx 10xxxxxx)
+		if((utf8Buffer & 0x00c0c0c0) == 0x00808080)
+			codePoint = ((utf8Buffer & 0x07000000) >> 6)
+			          | ((utf8Buffer & 0x003f0000) >> 4)
+			          | ((utf8Buffer & 0x00003f00) >> 2)
+			          | (utf8Buffer & 0x0000003f);
+	}
+	else if((utf8Buffer & 0xfff00000) == 0x00e00000)
+	{
+		// 3-byte character (1110xxxx 10xxxxxx 10xxxxxx)
+		if((utf8Buffer & 0x0000c0c0) == 0x00008080)
+			codePoint = ((utf8Buffer & 0x000f0000) >> 4)
+			          | ((utf8Buffer & 0x00003f00) >> 2)
+			          | (utf8Buffer & 0x0000003f);
+	}
+	else if((utf8Buffer & 0xffffe000) == 0x0000c000)
+	{
+		// 2-byte character (110xxxxx 10xxxxxx)
+		if((utf8Buffer & 0x000000c0) == 0x00000080)
+			codePoint = ((utf8Buffer & 0x00001f00) >> 2)
+			          | (utf8Buffer & 0x0000003f);
+	}
+	else if((utf8Buffer & 0xffffff80) == 0x00000000)
+	{
+		// 1-byte character (0xxxxxxx)
+		codePoint = utf8Buffer;
+	}
+	else
+		// Incomplete character, wait for more before writing
+		return;
+	utf8Buffer = 0;
+
+	uint8_t lcdCode;
+	switch(codePoint)
+	{
+	case 0x0000005c: lcdCode = LCD_CC_BACKSLASH; break; // Backslash (\)
+	case 0x0000007e: lcdCode = LCD_CC_TILDE; break; // Tilde ~
+	case 0x0000009d: lcdCode = 0x5c; break; // The Yen sign (¥) is where the backslash is supposed to be
+	case 0x00002192: lcdCode = 0x7e; break; // The right arrow (→) is where the tilde is supposed to be
+	case 0x00002190: lcdCode = 0x7f; break; // Left arrow (←)
+	case 0x00002092: lcdCode = 0xa1; break; // Subscript small o (ₒ)
+	case 0x000000da: lcdCode = 0xa2; break; // Single up and left (┘)
+	case 0x000000d9: lcdCode = 0xa3; break; // Single down and right (┌)
+	case 0x000000b7: lcdCode = 0xa5; break; // Middle dot (·)
+	case 0x00002203:
+	case 0x0000018e: lcdCode = 0xae; break; // Existential quantifier (∃)
+	case 0x000025af:
+	case 0x000025a1: lcdCode = 0xdb; break; // Vertical white rectangle (▯) or white square (□)
+	case 0x000000b0: lcdCode = 0xdf; break; // Degree sign (°)
+	case 0x000003b1: lcdCode = 0xe0; break; // Lowercase alpha (α)
+	case 0x000000e4: lcdCode = 0xe1; break; // Lowercase umlaut a (ä)
+	case 0x000003b2:
+	case 0x000000df: lcdCode = 0xe2; break; // Lowercase beta (β) or German Eszett (ß)
+	case 0x000003b5:
+	case 0x00000190: lcdCode = 0xe3; break; // Lowercase epsilon (ε)
+	case 0x000003bc:
+	case 0x000000b5: lcdCode = 0xe4; break; // Lowercase mu (μ) or micro sign (µ)
+	case 0x000003c3: lcdCode = 0xe5; break; // Lowercase sigma (σ)
+	case 0x000003c1: lcdCode = 0xe6; break; // Lowercase rho (ρ)
+	case 0x0000221a: lcdCode = 0xe8; break; // Square root symbol (√)
+	case 0x0000215f: lcdCode = 0xe9; break; // Inverse Symbol (⅟)
+	case 0x000000a2: lcdCode = 0xec; break; // Cent sign (¢)
+	case 0x000000f1: lcdCode = 0xee; break; // Lowercase n with tilde (ñ)
+	case 0x000000f6: lcdCode = 0xef; break; // Lowercase umlaut o (ö)
+	case 0x000003b8: lcdCode = 0xf2; break; // Lowercase theta (θ)
+	case 0x0000221e: lcdCode = 0xf3; break; // Infinity symbol (∞)
+	case 0x000003a9: lcdCode = 0xf4; break; // Uppercase omega (Ω)
+	case 0x000000fc: lcdCode = 0xf5; break; // Lowercase umlaut u (ü)
+	case 0x000003a3: lcdCode = 0xf6; break; // Uppercase sigma (Σ)
+	case 0x000003c0: lcdCode = 0xf7; break; // Lowercase pi (π)
+	case 0x000000f7: lcdCode = 0xfd; break; // Division sign (÷)
+	case 0x000025ae:
+	case 0x000025a0: lcdCode = 0xff; break; // Vertical black rectangle (▮) or black square (■)
+	default: if(codePoint <= 0x00000080) lcdCode = (uint8_t)codePoint; else lcdCode = 0xff;
+	}
+	sink = lcdCode;
+}
+
+// Number of cycles it takes to read TCNT1 twice
+static uint16_t overhead;
+
+// Measures the number of cycles a statement takes (Timer1 counting CPU cycles)
+#define CYCLES(statement) ({ \
+	uint16_t start, end; \
+	ATOMIC_BLOCK(ATOMIC_FORCEON) \
+	{ \
+		start = TCNT1; \
+		statement; \
+		end = TCNT1; \
+	} \
+	(uint16_t)(end - start - overhead); \
+})
+
+// Timer1 compare match interrupt (every 10ms)
+ISR(TIMER1_COMPA_vect)
+{
+	lcd_tick();
+}
+
 void main(void)
 {
 	// Initialisation
 	lcd_init();
 
+	// 0. Cycles per character, new and old way. Timer1 runs in normal mode
+	// with prescaler 1 for this, i.e. it counts CPU cycles. 
+	TCCR1A = 0;
+	TCCR1B = (0b001 << CS10);
+	overhead = CYCLES();
+	uint16_t ascii = CYCLES(lcd_writeChar('a'));
+	uint16_t umlaut = CYCLES(lcd_writeChar(0xc3); lcd_writeChar(0xa4));
+	uint16_t switchAscii = CYCLES(switchWriteChar('a'));
+	uint16_t switchUmlaut = CYCLES(switchWriteChar(0xc3); switchWriteChar(0xa4));
+	lcd_clear();
+	lcd_printf_P(PSTR("a:%4u (%u)\n"), ascii, switchAscii);
+	lcd_printf_P(PSTR("ä:%4u (%u)"), umlaut, switchUmlaut);
+	lcd_flush();
+	_delay_ms(5000);
+	TCCR1B = 0;
+	TCNT1 = 0;
+
+	// Timer1 in CTC mode with prescaler 64: 20MHz / 64 / 3125 = 100Hz
+	OCR1A = 3124;
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+	TIMSK1 = (1 << OCIE1A);
+	sei();
+
 	// 1. Print welcome message
-	printf("Hello world!");
+	lcd_writeProgString(PSTR("Hello world!"));
 	_delay_ms(2000);
 
 	// 2. Bar graph filling up from 0% to 100%
@@ -27,50 +191,71 @@ void main(void)
 
 		// Write percentage in line 2
 		lcd_line2();
-		printf("%d%%", percent);
+		lcd_printf_P(PSTR("%u%%"), percent);
 
 		// Wait a little
 		_delay_ms(100);
 	}
 	_delay_ms(2000);
 
+	// 2b. Bar graph with one step per pixel column, going up and down again
+	lcd_clear();
+	for(uint8_t level = 0; level <= 160; level++)
+	{
+		uint8_t fill = level <= 80 ? level : 160 - level;
+		lcd_drawFineBar(1, fill);
+		lcd_goto(2, 1);
+		lcd_printf_P(PSTR("%2u/80"), fill);
+		_delay_ms(25);
+	}
+	_delay_ms(2000);
+
+	// 2c. Counting as fast as possible. Only the latest count reaches the LCD,
+	// 25 times per second (LCD_FRAME_RATE), the rest only goes into RAM
+	lcd_clear();
+	lcd_writeProgString(PSTR("Counting:"));
+	for(uint16_t count = 0; count < 50000; count++)
+	{
+		lcd_goto(2, 1);
+		lcd_writeDec(count);
+	}
+	_delay_ms(2000);
+
 	// 3. Try some special characters
 	lcd_clear();
-	printf("Tilde: ~\nBackslash: \\");
+	lcd_writeProgString(PSTR("Tilde: ~\nBackslash: \\"));
 	_delay_ms(1000);
 	lcd_clear();
-	printf("Left Arrow: ←\nRight Arrow: →");
+	lcd_writeProgString(PSTR("Left Arrow: ←\nRight Arrow: →"));
 	_delay_ms(1000);
 	lcd_clear();
-	printf("Umlaut: äöü\nGreek: αβεμσρθπ");
+	lcd_writeProgString(PSTR("Umlaut: äöü\nGreek: αβεμσρθπ"));
 	_delay_ms(1000);
 	lcd_clear();
-	printf("Misc: ÷√⅟°∃□¢∞");
+	lcd_writeProgString(PSTR("Misc: ÷√⅟°∃□¢∞"));
 	_delay_ms(2000);
 
-	// 4. Animation
+	// 3b. The same, converted at compile time (literal.cpp)
+	writeLiterals();
+
+	// 4. Animation (runs in the background, driven by the timer interrupt)
 	lcd_clear();
-	printf("Animation:");
+	lcd_writeProgString(PSTR("Animation:"));
 	lcd_line2();
-	lcd_writeProgString(PSTR(""));
-	for(uint8_t i = 0; i < 20; i++)
-	{
-		switch(i % 8)
-		{
-		case 0: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0)); break;
-		case 1: lcd_registerCustomChar(7, CUSTOM_CHAR(0b01000, 0b01000, 0b00100, 0b00100, 0b00100, 0b00010, 0b00010, 0)); break;
-		case 2: lcd_registerCustomChar(7, CUSTOM_CHAR(0b10000, 0b10000, 0b01000, 0b00100, 0b00010, 0b00001, 0b00001, 0)); break;
-		case 3: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00000, 0b00000, 0b11000, 0b00100, 0b00011, 0b00000, 0b00000, 0)); break;
-		case 4: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00000, 0b00000, 0b00000, 0b11111, 0b00000, 0b00000, 0b00000, 0)); break;
-		case 5: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00000, 0b00000, 0b00011, 0b00100, 0b11000, 0b00000, 0b00000, 0)); break;
-		case 6: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00001, 0b00001, 0b00010, 0b00100, 0b01000, 0b10000, 0b10000, 0)); break;
-		case 7: lcd_registerCustomChar(7, CUSTOM_CHAR(0b00010, 0b00010, 0b00100, 0b00100, 0b00100, 0b01000, 0b01000, 0)); break;
-		}
-		_delay_ms(250);
-	}
+	lcd_writeProgString(PSTR("\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07\x07"));
+	lcd_animate(7, spinner, 8, 25);
+	_delay_ms(5000);
+	lcd_animate(7, 0, 0, 0);
 	_delay_ms(2000);
 
-	// 5. Line and page break
+	// 4b. Marquee (also runs in the background): one display shift per step,
+	// the second line is longer than the LCD's 40 columns and gets refilled
+	lcd_marquee(PSTR("Marquee with hardware display shift"),
+	            PSTR("This line is too long for the 40 columns of DDRAM, so it is refilled while it scrolls. "),
+	            30);
+	_delay_ms(15000);
+
+	// 5. Line break and scrolling
 	lcd_clear();
 	for(uint8_t i = 0; i < 104; i++)
 	{
@@ -130,9 +315,29 @@ void main(void)
 	}
 	_delay_ms(2000);
 
-	// 7. Finished
+	// 7. Log output, browsable with SW1 (back) and SW2 (forward)
 	lcd_clear();
+	for(uint8_t i = 1; i <= 6; i++)
+	{
+		lcd_printf_P(PSTR("Log line %u\n"), i);
+		_delay_ms(500);
+	}
 	lcd_writeString("  ~ Finished ~  ");
-	while(1);
+	// Buttons as inputs with pull-ups (pressed = low)
+	DDRC &= ~((1 << 0) | (1 << 1));
+	PORTC |= (1 << 0) | (1 << 1);
+	uint8_t back = 0;
+	while(1)
+	{
+		if(!(PINC & (1 << 0)))
+			back = lcd_scrollBack(back + 1);
+		else if(!(PINC & (1 << 1)) && back)
+			back = lcd_scrollBack(back - 1);
+		else
+			continue;
+		// Wait for the button to be released
+		while((PINC & ((1 << 0) | (1 << 1))) != ((1 << 0) | (1 << 1)));
+		_delay_ms(20);
+	}
 }
 
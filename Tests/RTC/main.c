@@ -22,6 +22,8 @@
  * From the values of Timer1's counter on two successive captures and the
  * number of overflows in between, we can calculate the number of CPU clock
  * ticks per second, i.e. the CPU frequency, which is displayed on the LCD. 
+ * The last 40 measurements are shown as a chart next to the label, scaled to
+ * the range between the lowest and the highest of them. 
  * 
  * You can also observe the temperature dependency of the two crystals by
  * carefully placing your finger on one of them. This might give you an idea of
@@ -30,6 +32,7 @@
 
 #include<avr/io.h>
 #include<avr/interrupt.h>
+#include<avr/pgmspace.h>
 #include"lcd.h"
 
 // Timer1 uses this flag to signal that a capture has taken place
@@ -44,6 +47,18 @@ volatile struct
 	uint16_t overflows;
 } captures[2];
 
+// The last measurements (0 if there is none yet), the oldest one at index next
+uint32_t history[LCD_CHART_WIDTH];
+uint8_t next = 0;
+
+// Heights of the columns in the chart
+uint8_t heights[LCD_CHART_WIDTH];
+
+// The frequency in line 2, only the digits that change are redrawn
+static const lcd_field_t fields[] PROGMEM = {
+	LCD_FIELD(2, 1, 8, 0)
+};
+
 // Overflow of Timer1's 16-bit counter occurs at <CPU clock> / 2^16
 ISR(TIMER1_OVF_vect)
 {
@@ -105,7 +120,11 @@ void main(void)
 	// The main loop recomputes and displays the frequency whenever the capture
 	// flag gets set
 	lcd_init();
-	lcd_writeString("CPU Frequency:");
+	lcd_writeString("CPU Freq");
+	lcd_writeChart();
+	lcd_goto(2, 9);
+	lcd_writeProgString(PSTR(" Hz"));
+	lcd_setFields(fields, 1);
 	while(1)
 	{
 		if(capture)
@@ -120,9 +139,33 @@ void main(void)
 			capture = 0;
 
 			// Display the frequency in line 2
-			lcd_erase(2);
-			lcd_line2();
-			printf("%lu Hz", clocks);
+			lcd_setField(0, clocks);
+			lcd_updateFields();
+
+			// Add it to the chart
+			history[next] = clocks;
+			if(++next == LCD_CHART_WIDTH)
+				next = 0;
+			uint32_t min = UINT32_MAX, max = 0;
+			for(uint8_t i = 0; i < LCD_CHART_WIDTH; i++)
+			{
+				if(!history[i])
+					continue;
+				if(history[i] < min)
+					min = history[i];
+				if(history[i] > max)
+					max = history[i];
+			}
+			for(uint8_t i = 0; i < LCD_CHART_WIDTH; i++)
+			{
+				if(!history[i])
+					heights[i] = 0;
+				else if(max == min)
+					heights[i] = 4;
+				else
+					heights[i] = 1 + (uint8_t)((history[i] - min) * 7 / (max - min));
+			}
+			lcd_updateChart(heights, next);
 		}
 	}
 }
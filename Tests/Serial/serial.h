@@ -17,7 +17,8 @@
  * - Stop bits: 1
  * - Flow Control: None
  * 
- * Copy serial.h and serial.c into your project. Then use it like so:
+ * Copy serial.h and serial.c as well as format.h and format.c (from
+ * Drivers/Format) into your project. Then use it like so:
  * 
  * #include"serial.h"
  * void main(void)
@@ -31,6 +32,7 @@
 #ifndef _SERIAL_H
 #define _SERIAL_H
 
+#include<stdint.h>
 #include<stdio.h>
 
 //=============================================================================
@@ -101,6 +103,61 @@ void serialTransmit(char c);
  */
 void serialFlush();
 
+/**
+ * \brief Transmits a string via UART
+ * 
+ * \param text The 0-terminated string to be transmitted
+ */
+void serialTransmitString(const char* text);
+
+/**
+ * \brief Transmits a string from program memory via UART
+ * 
+ * \param text Pointer to the 0-terminated string in program memory
+ */
+void serialTransmitProgString(const char* text);
+
+/**
+ * \brief Transmits an unsigned integer in decimal via UART
+ * 
+ * \param number The integer to be transmitted
+ */
+void serialTransmitDec(uint32_t number);
+
+/**
+ * \brief Transmits a signed integer in decimal via UART
+ * 
+ * \param number The integer to be transmitted
+ */
+void serialTransmitSignedDec(int32_t number);
+
+/**
+ * \brief Transmits a fixed-point number in decimal via UART
+ * 
+ * \param value The number in units of 10^-decimals, e.g. millivolts with
+ * decimals=3
+ * \param decimals Number of digits after the decimal point (at most 10)
+ */
+void serialTransmitFixed(int32_t value, uint8_t decimals);
+
+/**
+ * \brief Transmits formatted output via UART, like printf()
+ * 
+ * Much smaller and faster than printf(), but only supports %d, %u, %ld, %lu,
+ * %x, %lx, %c, %s, %S, and %% with an optional width (see formatPrint() in
+ * format.h). 
+ * \param format The format string
+ */
+void serialPrintf(const char* format, ...);
+
+/**
+ * \brief Transmits formatted output via UART with the format string in
+ * program memory
+ * 
+ * \param format The format string in program memory, e.g. PSTR("%u\r\n")
+ */
+void serialPrintf_P(const char* format, ...);
+
 /**
  * \brief Pointer to FILE through which stdio functions can write through
  * serial